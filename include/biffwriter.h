@@ -23,22 +23,43 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "stream.h"
+
 struct bwctx {
-  int byte_order;
   unsigned char *data;
   unsigned int _sz;  /* Don't touch */
+  unsigned int _cap; /* Don't touch */
   unsigned int datasize;
 
-  void (*append) (void *xlsctx, void *data, size_t size);
+  /* Called by bw_reserve() when the buffer has no room left for a record.
+   * It must leave at least size bytes free at data + _sz.  When NULL the
+   * buffer simply grows; worksheets backed by a temporary file use it to
+   * flush what has been buffered so far. */
+  int (*spill) (struct bwctx *bw, size_t size);
 };
 
 struct bwctx * bw_new(void);
 void bw_destroy(struct bwctx *bw);
 void bw_store_eof(struct bwctx *bw);
 void bw_store_bof(struct bwctx *bw, uint16_t type);
-void bw_append(void *xlsctx, void *data, size_t size);
-void bw_prepend(struct bwctx *bw, void *data, size_t size);
+int bw_resize(struct bwctx *bw, size_t size);
+int bw_make_room(struct bwctx *bw, size_t size);
+void bw_append(struct bwctx *bw, const void *data, size_t size);
+
+/* Reserve room for size bytes at the end of the stream.  A record is
+ * encoded directly into the returned buffer and becomes part of the stream
+ * once bw_commit() is called.  Returns NULL if no memory is available. */
+XL_INLINE unsigned char *bw_reserve(struct bwctx *bw, size_t size)
+{
+  if (bw->_cap - bw->_sz < size && bw_make_room(bw, size) == -1)
+    return NULL;
+  return bw->data + bw->_sz;
+}
 
-void reverse(unsigned char *data, int size);
+XL_INLINE void bw_commit(struct bwctx *bw, size_t size)
+{
+  bw->_sz += size;
+  bw->datasize += size;
+}
 
 #endif /* __XLS_BIFFWRITER_H__ */
@@ -24,5 +24,7 @@
 #include "workbook.h"
 #include "worksheet.h"
 #include "format.h"
+#include "xlarrow.h"
+#include "xlcsv.h"
 
 #endif /* __XLS_EXCEL_H__ */
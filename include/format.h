@@ -68,21 +68,23 @@ int fmt_gethash(struct xl_format *fmt);
 
 /* format setters */
 void fmt_set_bold(struct xl_format *fmt, int bold_val);
-void fmt_set_color(struct xl_format *fmt, char *colorname);
-void fmt_set_align(struct xl_format *fmt, char *align);
+void fmt_set_color(struct xl_format *fmt, const char *colorname);
+void fmt_set_align(struct xl_format *fmt, const char *align);
 void fmt_set_size(struct xl_format *fmt, int size);
-void fmt_set_font(struct xl_format *fmt, char *font);
+void fmt_set_font(struct xl_format *fmt, const char *font);
+void fmt_set_font_n(struct xl_format *fmt, const char *font, size_t len);
 void fmt_set_colori(struct xl_format *fmt, int colorval);
 void fmt_set_num_format(struct xl_format *fmt, int format);
-void fmt_set_border_color(struct xl_format *fmt, char *colorname);
+void fmt_set_border_color(struct xl_format *fmt, const char *colorname);
 void fmt_set_border(struct xl_format *fmt, int format);
 void fmt_set_pattern(struct xl_format *fmt, int pattern);
-void fmt_set_bg_color(struct xl_format *fmt, char *colorname);
-void fmt_set_fg_color(struct xl_format *fmt, char *colorname);
+void fmt_set_bg_color(struct xl_format *fmt, const char *colorname);
+void fmt_set_fg_color(struct xl_format *fmt, const char *colorname);
 void fmt_set_text_wrap(struct xl_format *fmt, int val);
 void fmt_set_rotation(struct xl_format *fmt, int val);
 void fmt_set_merge(struct xl_format *fmt);
 void fmt_set_underline(struct xl_format *fmt, int val);
-void fmt_set_num_format_str(struct xl_format *fmt, char *str);
+void fmt_set_num_format_str(struct xl_format *fmt, const char *str);
+void fmt_set_num_format_str_n(struct xl_format *fmt, const char *str, size_t len);
 
 #endif /* __XLS_FORMAT_H__ */
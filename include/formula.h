@@ -21,6 +21,14 @@
 
 #include "stream.h"
 
+/* Most tokens and bytes of token text a single formula may contain */
+#define FORMULA_MAXTOKENS 128
+#define FORMULA_MAXTEXT 1024
+
+/* No token encodes to more than 4 bytes, so a packet of this size always
+ * holds the output of process_formula() */
+#define FORMULA_MAXLEN (FORMULA_MAXTOKENS * 4)
+
 int process_formula(char *input, struct pkt *pkt);
 
 #endif /* __XLS_FORMULA_H__ */
@@ -25,9 +25,15 @@ struct xl_io_handler {
   int   (*close )(void* handle);
 };
 
+/* Optional companion of a handler, see wbook_set_io_fileno().  Flushes
+ * anything buffered and returns a file descriptor that data may be
+ * written to directly, or -1 if there is none. */
+typedef int (*xl_io_fileno)(void* handle);
+
 void* xl_file_create(const char *filename);
 int   xl_file_write(void *handle,const void* buffer,size_t size);
 int   xl_file_close(void *handle);
+int   xl_file_fileno(void *handle);
 
 extern struct xl_io_handler xl_file_handler;
 
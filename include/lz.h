@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __XLS_LZ_H__
+#define __XLS_LZ_H__
+
+#include <stddef.h>
+
+/* Largest block xl_lz_compress() accepts */
+#define XL_LZ_MAXBLOCK 65536
+
+/* Room needed in dst to compress n bytes whatever they hold */
+#define XL_LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+size_t xl_lz_compress(const void *src, size_t n, void *dst, size_t cap);
+size_t xl_lz_decompress(const void *src, size_t n, void *dst, size_t cap);
+
+#endif /* __XLS_LZ_H__ */
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __XLS_NUMPARSE_H__
+#define __XLS_NUMPARSE_H__
+
+#include <stddef.h>
+
+/* What xl_parse_text() found */
+#define XL_TEXT_STRING   0
+#define XL_TEXT_NUMBER   1
+#define XL_TEXT_PERCENT  2
+#define XL_TEXT_DATE     3
+#define XL_TEXT_DATETIME 4
+#define XL_TEXT_TIME     5
+
+int xl_parse_double(const char *s, size_t len, double *out);
+int xl_parse_text(const char *s, size_t len, double *out);
+
+#endif /* __XLS_NUMPARSE_H__ */
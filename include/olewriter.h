@@ -27,6 +27,7 @@
 struct owctx {
   const char *olefilename;
   struct xl_io_handler io_handler;
+  xl_io_fileno io_fileno;
   void* io_handle;
   int fileclosed;
   int biff_only;
@@ -44,7 +45,9 @@ struct owctx * ow_new_ex(struct xl_io_handler io_handler, const char *filename);
 void ow_destroy(struct owctx *ow);
 int ow_set_size(struct owctx *ow, int biffsize);
 void ow_write_header(struct owctx *ow);
-void ow_write(struct owctx *ow, void *data, size_t size);
+void ow_write(struct owctx *ow, const void *data, size_t size);
+void ow_set_fileno(struct owctx *ow, xl_io_fileno fn);
+int ow_fileno(struct owctx *ow);
 void ow_close(struct owctx *ow);
 
 #endif /* __XLS_OLEWRITER_H__ */
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __XLS_SPILL_H__
+#define __XLS_SPILL_H__
+
+#include <stdio.h>
+
+/* Spill backends, see wbook_set_spill() */
+#define XL_SPILL_STDIO 0 /* tmpfile() written with fwrite */
+#define XL_SPILL_MMAP  1 /* Unlinked file written through an mmap window */
+#define XL_SPILL_LZ    0x10 /* Or'ed with a backend: compress the data */
+
+/* One stretch of a stream's data in the file */
+struct xl_extent {
+  size_t off;
+  size_t len;
+};
+
+/* Temporary storage for worksheet records that do not fit in memory.  The
+ * worksheets of a workbook share one file, opened when the first of them
+ * spills; each appends to it as its buffer fills, so that its data ends
+ * up as a list of extents.  Everything is written before it is read back,
+ * one stream at a time. */
+struct xl_spillfile {
+  int backend;
+  int compress;        /* XL_SPILL_LZ was given */
+  const char *dir;     /* Where the file is created, NULL for the default */
+  unsigned char *zbuf; /* One compressed block */
+  FILE *fp;            /* XL_SPILL_STDIO */
+  int fd;              /* XL_SPILL_MMAP */
+  size_t size;         /* Bytes written to the file */
+  size_t filesize;     /* Bytes allocated to the file */
+  size_t fpos;         /* Position of fp */
+  int reading;         /* The last use of fp was a read */
+  unsigned char *win;  /* Mapped window, NULL if none */
+  size_t win_off;      /* File offset of the window */
+  size_t win_len;
+  void *lock;          /* Taken by writers, see spill_file_shared() */
+};
+
+/* The data of one worksheet in a spill file */
+struct xl_spill {
+  struct xl_spillfile *file;
+  struct xl_extent *ext;
+  int nexts;
+  int extcap;
+  size_t size;  /* Bytes in the extents */
+  int cur;      /* Extent being read */
+  size_t pos;   /* Read position in it */
+};
+
+void spill_file_init(struct xl_spillfile *f);
+int spill_file_setup(struct xl_spillfile *f, int backend, const char *dir);
+int spill_file_shared(struct xl_spillfile *f);
+void spill_file_close(struct xl_spillfile *f);
+struct xl_spill *spill_new(struct xl_spillfile *f);
+void spill_destroy(struct xl_spill *sp);
+int spill_write(struct xl_spill *sp, const void *data, size_t len);
+int spill_finish(struct xl_spill *sp);
+const unsigned char *spill_read(struct xl_spill *sp, unsigned char *buf, size_t cap, size_t *len);
+int spill_fd(struct xl_spill *sp);
+int spill_extent(struct xl_spill *sp, size_t *off, size_t *len);
+void spill_skip(struct xl_spill *sp, size_t len);
+
+#endif /* __XLS_SPILL_H__ */
@@ -40,6 +40,26 @@
 
 #include <sys/types.h>
 #include <stdint.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#define XL_INLINE static __inline
+#else
+#define XL_INLINE static inline
+#endif
+
+/* Host byte order, resolved at compile time.  BIFF is little endian, so
+ * only big endian hosts need to swap.  Define XL_BIG_ENDIAN by hand for
+ * compilers that do not advertise their byte order. */
+#if !defined(XL_BIG_ENDIAN)
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__)
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define XL_BIG_ENDIAN 1
+#endif
+#elif defined(__BIG_ENDIAN__) || defined(__ARMEB__) || defined(__MIPSEB__)
+#define XL_BIG_ENDIAN 1
+#endif
+#endif
 
 #define VARIABLE_PACKET		1
 #define FIXED_PACKET		2
@@ -48,6 +68,8 @@ struct pkt {
   unsigned char *data;
   size_t offset;
   size_t len;
+  size_t size;	/* Capacity of data */
+  int type;	/* VARIABLE_PACKET packets grow on demand */
 };
 
 struct pkt_rdr
@@ -58,19 +80,87 @@ struct pkt_rdr
 };
 
 /* packet creation functions */
-void pkt_addraw(struct pkt *p, const unsigned char *bytes, size_t len);
-void pkt_addzero(struct pkt *p, int num_zeros);
-void pkt_add8(struct pkt *p, uint8_t val);
-void pkt_add16(struct pkt *p, uint16_t val);
-void pkt_add16_le(struct pkt *p, uint16_t val);
-void pkt_add32(struct pkt *p, uint32_t val);
-void pkt_add32_le(struct pkt *p, uint32_t val);
+int pkt_addraw(struct pkt *p, const unsigned char *bytes, size_t len);
+int pkt_addzero(struct pkt *p, int num_zeros);
+int pkt_add8(struct pkt *p, uint8_t val);
+int pkt_add16(struct pkt *p, uint16_t val);
+int pkt_add16_le(struct pkt *p, uint16_t val);
+int pkt_add32(struct pkt *p, uint32_t val);
+int pkt_add32_le(struct pkt *p, uint32_t val);
 void pkt_write_data_len(struct pkt *p);
-void pkt_addstring(struct pkt *p, const char *bytes);
+int pkt_addstring(struct pkt *p, const char *bytes);
 void pkt_free(struct pkt * p);
 
 /* Raw routines */
 struct pkt * pkt_init(size_t len, int type);
+void pkt_attach(struct pkt *p, unsigned char *buf, size_t size);
+unsigned char *pkt_grow(struct pkt *p, size_t len);
+void xl_putdoubles(unsigned char *d, const double *vals, size_t n);
+
+/* Fast path encoders.  pkt_reserve() checks once that a whole record fits
+ * and returns where it goes; the xl_put*() helpers then store each field
+ * without further checks and return the position after it.  pkt_commit()
+ * accounts for the bytes written. */
+XL_INLINE unsigned char *pkt_reserve(struct pkt *p, size_t len)
+{
+	if (p->size - p->offset < len)
+		return pkt_grow(p, len);
+	return p->data + p->offset;
+}
+
+XL_INLINE void pkt_commit(struct pkt *p, size_t len)
+{
+	p->offset += len;
+	p->len += len;
+}
+
+XL_INLINE unsigned char *xl_put8(unsigned char *d, uint8_t val)
+{
+	d[0] = val;
+	return d + 1;
+}
+
+XL_INLINE unsigned char *xl_put16_le(unsigned char *d, uint16_t val)
+{
+	d[0] = val & 0xff;
+	d[1] = val >> 8;
+	return d + 2;
+}
+
+XL_INLINE unsigned char *xl_put32_le(unsigned char *d, uint32_t val)
+{
+	d[0] = val & 0xff;
+	d[1] = (val >> 8) & 0xff;
+	d[2] = (val >> 16) & 0xff;
+	d[3] = val >> 24;
+	return d + 4;
+}
+
+XL_INLINE unsigned char *xl_put64_le(unsigned char *d, uint64_t val)
+{
+	d = xl_put32_le(d, (uint32_t)val);
+	return xl_put32_le(d, (uint32_t)(val >> 32));
+}
+
+/* IEEE 754 double in BIFF (little endian) byte order */
+XL_INLINE unsigned char *xl_putdouble(unsigned char *d, double val)
+{
+#ifdef XL_BIG_ENDIAN
+	uint64_t bits;
+
+	memcpy(&bits, &val, sizeof(bits));
+	return xl_put64_le(d, bits);
+#else
+	memcpy(d, &val, sizeof(val));
+	return d + sizeof(val);
+#endif
+}
+
+XL_INLINE unsigned char *xl_putraw(unsigned char *d, const void *bytes, size_t len)
+{
+	memcpy(d, bytes, len);
+	return d + len;
+}
 
 #endif /* __STREAM_H__ */
 
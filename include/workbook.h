@@ -32,6 +32,11 @@ struct wbookctx {
   struct bwctx *biff;
 
   int store_in_memory;
+  int threads;
+  int spill_backend;
+  char *tmpdir;
+  struct xl_spillfile spill;
+  struct xl_budget budget;
   struct owctx *OLEwriter;
   int epoch1904;
   int activesheet;
@@ -42,12 +47,15 @@ struct wbookctx {
   char *sheetname;
   struct xl_format *tmp_format;
   struct xl_format *url_format;
+  struct xl_defaults defaults;
   int xf_index;
 
   int sheetcount;
+  int sheetcap;
   struct wsheetctx **sheets;
 
   int formatcount;
+  int formatcap;
   struct xl_format **formats;
 };
 
@@ -55,7 +63,13 @@ struct wbookctx *wbook_new(const char *filename, int store_in_memory);
 struct wbookctx *wbook_new_ex(struct xl_io_handler io_handler, const char *filename, int store_in_memory);
 void wbook_close(struct wbookctx *wb);
 void wbook_destroy(struct wbookctx *wb);
-struct wsheetctx *wbook_addworksheet(struct wbookctx *wbook, char *sname);
+struct wsheetctx *wbook_addworksheet(struct wbookctx *wbook, const char *sname);
+struct wsheetctx *wbook_addworksheet_n(struct wbookctx *wbook, const char *sname, size_t len);
 struct xl_format *wbook_addformat(struct wbookctx *wbook);
+void wbook_set_spill(struct wbookctx *wbook, int backend);
+void wbook_set_tmpdir(struct wbookctx *wbook, const char *dir);
+void wbook_set_io_fileno(struct wbookctx *wbook, xl_io_fileno fn);
+void wbook_set_memory_budget(struct wbookctx *wbook, size_t bytes);
+void wbook_set_threads(struct wbookctx *wbook, int n);
 
 #endif /* __XLS_WORKBOOK_H__ */
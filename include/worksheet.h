@@ -24,6 +24,7 @@
 #include "biffwriter.h"
 #include "bsdqueue.h"
 #include "format.h"
+#include "spill.h"
 
 struct col_info {
   int first_col;
@@ -35,6 +36,83 @@ struct col_info {
   TAILQ_ENTRY(col_info) cis;
 };
 
+/* BIFF5 sheet limits */
+#define XLS_ROWMAX 65536
+#define XLS_COLMAX 256
+#define XLS_STRMAX 255
+
+/* Built in formats of the workbook, see wsheet_default_format() */
+#define XLS_FMT_DATE     0 /* m/d/yy */
+#define XLS_FMT_DATETIME 1 /* m/d/yy h:mm */
+#define XLS_FMT_TIME     2 /* h:mm:ss */
+#define XLS_FMT_PERCENT  3 /* 0.00% */
+#define XLS_FMT_COUNT    4
+
+/* Matrix layouts for xls_write_matrix() */
+#define XLS_ROW_MAJOR 0
+#define XLS_COL_MAJOR 1
+
+/* Field types for xls_write_structs() */
+#define XLS_FIELD_DOUBLE 0 /* double */
+#define XLS_FIELD_INT32  1 /* int32_t */
+#define XLS_FIELD_STRING 2 /* const char *, NULL leaves the cell empty */
+
+/* The built in formats, shared by the sheets of a workbook.  Each is only
+ * added to the workbook, by add(), when a sheet first needs it, so that
+ * the XF indexes of the user's formats do not move. */
+struct xl_defaults {
+  struct xl_format *fmt[XLS_FMT_COUNT];
+  struct xl_format *(*add)(void *ctx, int which);
+  void *ctx;
+};
+
+/* Describes one member of a struct and the column it is written to */
+struct xl_field {
+  size_t offset; /* offsetof() the member */
+  int type;
+  int col;
+  struct xl_format *fmt;
+};
+
+/* A compiled list of fields, see xls_schema_new() */
+struct xl_schema_field {
+  size_t offset;
+  int type;
+  int col;
+  unsigned char tmpl[10]; /* Record header, column and XF */
+};
+
+struct xl_schema {
+  struct xl_schema_field *fields;
+  int nfields;
+  int min_col;
+  int max_col;
+};
+
+/* Row cursor, see xls_row_begin().  Numbers that fit an RK and blank
+ * cells are held back as a run so that each run becomes one MULRK or
+ * MULBLANK record; everything else is written as soon as it is added. */
+struct xl_row {
+  struct wsheetctx *ws;
+  int row;        /* -1 when no row is open */
+  int col;        /* Column of the next cell */
+  int first_col;  /* First column written, -1 if none yet */
+  int last_col;   /* Last column written */
+  int run_kind;
+  int run_col;
+  int run_len;
+  uint16_t run_xf[XLS_COLMAX];
+  uint32_t run_rk[XLS_COLMAX];
+};
+
+/* Memory shared by the worksheets of a workbook that are kept in memory,
+ * see wbook_set_memory_budget() */
+struct xl_budget {
+  size_t limit;
+  size_t used;  /* Buffer capacity of the sheets in the list */
+  TAILQ_HEAD(budget_list, wsheetctx) sheets;
+};
+
 struct wsheetctx {
   struct bwctx base;
   char *name;
@@ -42,9 +120,13 @@ struct wsheetctx {
   int activesheet;
   int firstsheet;
   struct xl_format *url_format;
+  struct xl_defaults *defaults;      /* Set by the workbook */
   int using_tmpfile;
 
-  FILE *fp;
+  struct xl_spillfile *spillfile; /* Shared by the workbook's sheets */
+  struct xl_spill *sp;  /* This sheet's part of it, NULL until it spills */
+  struct xl_budget *budget;  /* NULL unless held in memory under a budget */
+  TAILQ_ENTRY(wsheetctx) budget_link;
   int fileclosed;
   int offset;
   int xls_rowmax;
@@ -61,19 +143,50 @@ struct wsheetctx {
   int sel_lcol;
 
   TAILQ_HEAD(colinfo_list, col_info) colinfos;
+
+  struct xl_row *cursor; /* Row cursor, NULL until xls_row_begin() */
+  struct bwctx head; /* BOF to DIMENSIONS, built by wsheet_close() */
+  int drain;         /* Progress of wsheet_get_data() */
 };
 
-struct wsheetctx * wsheet_new(char *name, int index, int activesheet, int firstsheet, struct xl_format *url, int store_in_memory);
+struct wsheetctx * wsheet_new(const char *name, int index, int activesheet, int firstsheet, struct xl_format *url, int store_in_memory);
 void wsheet_destroy(struct wsheetctx *xls);
+void wsheet_set_budget(struct wsheetctx *xls, struct xl_budget *budget);
+void wsheet_unbudget(struct wsheetctx *xls);
+struct xl_format *wsheet_default_format(struct wsheetctx *xls, int which);
 int xls_write_number(struct wsheetctx *xls, int row, int col, double num);
-int xls_write_string(struct wsheetctx *xls, int row, int col, char *str);
-int xls_writef_string(struct wsheetctx *xls, int row, int col, char *str, struct xl_format *fmt);
+int xls_write_string(struct wsheetctx *xls, int row, int col, const char *str);
+int xls_writef_string(struct wsheetctx *xls, int row, int col, const char *str, struct xl_format *fmt);
+int xls_writef_string_n(struct wsheetctx *xls, int row, int col, const char *str, size_t len, struct xl_format *fmt);
 int xls_writef_number(struct wsheetctx *xls, int row, int col, double num, struct xl_format *fmt);
+int xls_write_int(struct wsheetctx *xls, int row, int col, int32_t num);
+int xls_writef_int(struct wsheetctx *xls, int row, int col, int32_t num, struct xl_format *fmt);
+int xls_write_row_numbers(struct wsheetctx *xls, int row, int first_col, const double *vals, int n, struct xl_format *fmt);
+int xls_write_row_numbers_fmt(struct wsheetctx *xls, int row, int first_col, const double *vals, int n, struct xl_format *const *fmts);
+int xls_write_matrix(struct wsheetctx *xls, int top, int left, int rows, int cols, const double *data, int layout, struct xl_format *fmt);
+int xls_write_col_numbers(struct wsheetctx *xls, int first_row, int col, const double *vals, size_t n, size_t stride_bytes, struct xl_format *fmt);
+int xls_write_col_ints(struct wsheetctx *xls, int first_row, int col, const int32_t *vals, size_t n, size_t stride_bytes, struct xl_format *fmt);
+int xls_write_col_strings(struct wsheetctx *xls, int first_row, int col, const char *const *strs, size_t n, size_t stride_bytes, struct xl_format *fmt);
+struct xl_schema *xls_schema_new(const struct xl_field *fields, int nfields);
+void xls_schema_destroy(struct xl_schema *schema);
+int xls_write_structs(struct wsheetctx *xls, int first_row, const struct xl_schema *schema, const void *base, size_t count, size_t stride);
+struct xl_row *xls_row_begin(struct wsheetctx *xls, int row);
+int xls_row_add_number(struct xl_row *cur, double num, struct xl_format *fmt);
+int xls_row_add_string(struct xl_row *cur, const char *str, struct xl_format *fmt);
+int xls_row_add_string_n(struct xl_row *cur, const char *str, size_t len, struct xl_format *fmt);
+int xls_row_add_bool(struct xl_row *cur, int value, struct xl_format *fmt);
+int xls_row_add_blank(struct xl_row *cur, struct xl_format *fmt);
+int xls_row_skip(struct xl_row *cur, int n);
+int xls_row_end(struct xl_row *cur);
+int xls_write_auto(struct wsheetctx *xls, int row, int col, const char *text, size_t len, struct xl_format *fmt);
 int xls_write_blank(struct wsheetctx *xls, int row, int col, struct xl_format *fmt);
+int xls_write_blank_range(struct wsheetctx *xls, int frow, int fcol, int lrow, int lcol, struct xl_format *fmt);
 int wsheet_writef_formula(struct wsheetctx *xls, int row, int col, char *formula, struct xl_format *fmt);
-int wsheet_write_url(struct wsheetctx *wsheet, int row, int col, char *url, char *str, struct xl_format *fmt);
+int wsheet_write_url(struct wsheetctx *wsheet, int row, int col, const char *url, const char *str, struct xl_format *fmt);
+int wsheet_write_url_n(struct wsheetctx *wsheet, int row, int col, const char *url, size_t urllen, const char *str, size_t len, struct xl_format *fmt);
 void wsheet_close(struct wsheetctx *xls);
-unsigned char *wsheet_get_data(struct wsheetctx *ws, size_t *sz);
+const unsigned char *wsheet_get_data(struct wsheetctx *ws, size_t *sz);
+int wsheet_send_data(struct wsheetctx *ws, int fd);
 void wsheet_set_column(struct wsheetctx *ws, int fcol, int lcol, int width);
 void wsheet_set_selection(struct wsheetctx *ws, int frow, int fcol, int lrow, int lcol);
 void wsheet_set_row(struct wsheetctx *ws, int row, int height, struct xl_format *fmt);
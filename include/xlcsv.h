@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __XLS_XLCSV_H__
+#define __XLS_XLCSV_H__
+
+#include "worksheet.h"
+
+/* Options for xls_import_csv().  A zeroed struct (or a NULL pointer)
+ * gives the defaults: comma separated, double quotes, starting at A1. */
+struct xl_csv_options {
+  char delimiter;         /* Field separator, ',' if 0 */
+  char quote;             /* Quote character, '"' if 0 */
+  int first_row;
+  int first_col;
+  int text_only;          /* Write every field as a string */
+  struct xl_format *fmt;  /* Format of every cell, may be NULL */
+};
+
+int xls_import_csv(struct wsheetctx *xls, const char *path, const struct xl_csv_options *opts);
+int xls_import_csv_fd(struct wsheetctx *xls, int fd, const struct xl_csv_options *opts);
+
+#endif /* __XLS_XLCSV_H__ */
@@ -85,10 +85,18 @@ LIB32=link.exe -lib
 # PROP Default_Filter "cpp;c;cxx;rc;def;r;odl;idl;hpj;bat"
 # Begin Source File
 
+SOURCE=..\src\arrow.c
+# End Source File
+# Begin Source File
+
 SOURCE=..\src\biffwriter.c
 # End Source File
 # Begin Source File
 
+SOURCE=..\src\csv.c
+# End Source File
+# Begin Source File
+
 SOURCE=..\src\format.c
 # End Source File
 # Begin Source File
@@ -101,10 +109,26 @@ SOURCE=..\src\hashhelp.c
 # End Source File
 # Begin Source File
 
+SOURCE=..\src\io_handler.c
+# End Source File
+# Begin Source File
+
+SOURCE=..\src\lz.c
+# End Source File
+# Begin Source File
+
+SOURCE=..\src\numparse.c
+# End Source File
+# Begin Source File
+
 SOURCE=..\src\olewriter.c
 # End Source File
 # Begin Source File
 
+SOURCE=..\src\spill.c
+# End Source File
+# Begin Source File
+
 SOURCE=..\src\stream.c
 # End Source File
 # Begin Source File
@@ -145,10 +169,26 @@ SOURCE=..\include\hashhelp.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\include\io_handler.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\include\lz.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\include\numparse.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\include\olewriter.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\include\spill.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\stdint.h
 # End Source File
 # Begin Source File
@@ -163,6 +203,14 @@ SOURCE=..\include\workbook.h
 
 SOURCE=..\include\worksheet.h
 # End Source File
+# Begin Source File
+
+SOURCE=..\include\xlarrow.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\include\xlcsv.h
+# End Source File
 # End Group
 # End Target
 # End Project
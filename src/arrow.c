@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "xlarrow.h"
+
+/* Column types we know how to write */
+#define ARROW_INT8      0
+#define ARROW_UINT8     1
+#define ARROW_INT16     2
+#define ARROW_UINT16    3
+#define ARROW_INT32     4
+#define ARROW_UINT32    5
+#define ARROW_INT64     6
+#define ARROW_UINT64    7
+#define ARROW_FLOAT     8
+#define ARROW_DOUBLE    9
+#define ARROW_BOOL      10
+#define ARROW_UTF8      11
+#define ARROW_LARGEUTF8 12
+#define ARROW_DATE32    13
+#define ARROW_DATE64    14
+#define ARROW_TIMESTAMP 15
+
+/* Excel serial number of 1970-01-01 in the 1900 date system */
+#define XLS_UNIX_EPOCH 25569.0
+
+/* One column of the table, with its buffers resolved */
+struct xl_arrow_col {
+  int type;
+  int64_t offset;            /* Slot of the first row in the buffers */
+  const uint8_t *validity;   /* NULL when every value is present */
+  const void *values;
+  const void *offsets;       /* String offsets */
+  const char *chars;         /* String data */
+  int64_t per_day;           /* Timestamp units in a day */
+  struct xl_format *fmt;
+};
+
+static const struct {
+  const char *format;
+  int type;
+} arrow_types[] = {
+  { "c", ARROW_INT8 },
+  { "C", ARROW_UINT8 },
+  { "s", ARROW_INT16 },
+  { "S", ARROW_UINT16 },
+  { "i", ARROW_INT32 },
+  { "I", ARROW_UINT32 },
+  { "l", ARROW_INT64 },
+  { "L", ARROW_UINT64 },
+  { "f", ARROW_FLOAT },
+  { "g", ARROW_DOUBLE },
+  { "b", ARROW_BOOL },
+  { "u", ARROW_UTF8 },
+  { "U", ARROW_LARGEUTF8 },
+  { "tdD", ARROW_DATE32 },
+  { "tdm", ARROW_DATE64 }
+};
+
+/* Resolve the format string and buffers of one column.  Returns -2 for
+ * a type that cannot be written to a cell. */
+static int arrow_col_init(struct wsheetctx *xls, struct xl_arrow_col *col, struct ArrowSchema *schema, struct ArrowArray *array)
+{
+  const char *format = schema->format;
+  size_t i;
+
+  if (schema->dictionary != NULL)
+    return -2;
+
+  col->type = -1;
+  for (i = 0; i < sizeof(arrow_types) / sizeof(arrow_types[0]); i++) {
+    if (strcmp(format, arrow_types[i].format) == 0) {
+      col->type = arrow_types[i].type;
+      break;
+    }
+  }
+
+  /* Timestamps carry their unit and an optional time zone, "tsu:UTC".
+   * Values are written as they are, in UTC. */
+  if (col->type == -1 && strncmp(format, "ts", 2) == 0 && format[2] != '\0' && format[3] == ':') {
+    col->type = ARROW_TIMESTAMP;
+    switch (format[2]) {
+    case 's': col->per_day = 86400LL; break;
+    case 'm': col->per_day = 86400000LL; break;
+    case 'u': col->per_day = 86400000000LL; break;
+    case 'n': col->per_day = 86400000000000LL; break;
+    default: return -2;
+    }
+  }
+
+  if (col->type == -1)
+    return -2;
+  if (array->n_buffers < (col->type == ARROW_UTF8 || col->type == ARROW_LARGEUTF8 ? 3 : 2))
+    return -2;
+
+  col->offset = array->offset;
+  col->validity = array->null_count != 0 ? array->buffers[0] : NULL;
+  col->values = array->buffers[1];
+  col->offsets = NULL;
+  col->chars = NULL;
+  col->fmt = NULL;
+
+  switch (col->type) {
+  case ARROW_UTF8:
+  case ARROW_LARGEUTF8:
+    col->offsets = array->buffers[1];
+    col->chars = array->buffers[2];
+    break;
+  case ARROW_DATE32:
+    col->fmt = wsheet_default_format(xls, XLS_FMT_DATE);
+    break;
+  case ARROW_DATE64:
+    col->per_day = 86400000LL;
+    col->fmt = wsheet_default_format(xls, XLS_FMT_DATETIME);
+    break;
+  case ARROW_TIMESTAMP:
+    col->fmt = wsheet_default_format(xls, XLS_FMT_DATETIME);
+    break;
+  }
+
+  return 0;
+}
+
+/* Excel date serial of a count of units since the Unix epoch.  Whole
+ * days and the remainder are converted separately to keep the precision
+ * of nanosecond timestamps. */
+static double arrow_serial(int64_t v, int64_t per_day)
+{
+  int64_t days = v / per_day;
+  int64_t rem = v % per_day;
+
+  if (rem < 0) {
+    rem += per_day;
+    days--;
+  }
+
+  return XLS_UNIX_EPOCH + (double)days + (double)rem / (double)per_day;
+}
+
+/* Add slot i of col to the cursor's row */
+static int arrow_add_cell(struct xl_row *cur, const struct xl_arrow_col *col, int64_t i)
+{
+  int64_t start, end;
+
+  if (col->validity != NULL && !(col->validity[i >> 3] & (1 << (i & 7))))
+    return xls_row_skip(cur, 1);
+
+  switch (col->type) {
+  case ARROW_INT8:
+    return xls_row_add_number(cur, ((const int8_t *)col->values)[i], col->fmt);
+  case ARROW_UINT8:
+    return xls_row_add_number(cur, ((const uint8_t *)col->values)[i], col->fmt);
+  case ARROW_INT16:
+    return xls_row_add_number(cur, ((const int16_t *)col->values)[i], col->fmt);
+  case ARROW_UINT16:
+    return xls_row_add_number(cur, ((const uint16_t *)col->values)[i], col->fmt);
+  case ARROW_INT32:
+    return xls_row_add_number(cur, ((const int32_t *)col->values)[i], col->fmt);
+  case ARROW_UINT32:
+    return xls_row_add_number(cur, ((const uint32_t *)col->values)[i], col->fmt);
+  case ARROW_INT64:
+    return xls_row_add_number(cur, (double)((const int64_t *)col->values)[i], col->fmt);
+  case ARROW_UINT64:
+    return xls_row_add_number(cur, (double)((const uint64_t *)col->values)[i], col->fmt);
+  case ARROW_FLOAT:
+    return xls_row_add_number(cur, ((const float *)col->values)[i], col->fmt);
+  case ARROW_DOUBLE:
+    return xls_row_add_number(cur, ((const double *)col->values)[i], col->fmt);
+  case ARROW_BOOL:
+    return xls_row_add_bool(cur, (((const uint8_t *)col->values)[i >> 3] >> (i & 7)) & 1, col->fmt);
+  case ARROW_UTF8:
+    start = ((const int32_t *)col->offsets)[i];
+    end = ((const int32_t *)col->offsets)[i + 1];
+    return xls_row_add_string_n(cur, col->chars + start, (size_t)(end - start), col->fmt);
+  case ARROW_LARGEUTF8:
+    start = ((const int64_t *)col->offsets)[i];
+    end = ((const int64_t *)col->offsets)[i + 1];
+    return xls_row_add_string_n(cur, col->chars + start, (size_t)(end - start), col->fmt);
+  case ARROW_DATE32:
+    return xls_row_add_number(cur, XLS_UNIX_EPOCH + ((const int32_t *)col->values)[i], col->fmt);
+  default: /* ARROW_DATE64, ARROW_TIMESTAMP */
+    return xls_row_add_number(cur, arrow_serial(((const int64_t *)col->values)[i], col->per_day), col->fmt);
+  }
+}
+
+/* Write a table exported through the Arrow C data interface with its top
+ * left cell at (first_row, first_col).  schema and array describe either
+ * a struct ("+s") whose children are the columns, or a single column.
+ * Integers, floats, booleans, UTF-8 strings, dates and timestamps are
+ * supported; dates and timestamps get the sheet's date formats.  Null
+ * values leave their cell empty, and null rows of a struct leave their
+ * whole row empty.  The buffers are read in place and
+ * neither struct is released.  Returns -2 if the table does not fit on
+ * the sheet or has a column of another type. */
+int xls_write_arrow(struct wsheetctx *xls, int first_row, int first_col, struct ArrowSchema *schema, struct ArrowArray *array)
+{
+  struct xl_arrow_col cols[XLS_COLMAX];
+  const uint8_t *validity = NULL;  /* Of the struct's own rows */
+  int64_t ncols, nrows, r, i;
+  int c, ret;
+
+  if (first_row < 0 || first_col < 0)
+    return -2;
+
+  nrows = array->length;
+
+  if (strcmp(schema->format, "+s") == 0) {
+    ncols = schema->n_children;
+    if (array->n_children != ncols)
+      return -2;
+    if (ncols > xls->xls_colmax - first_col)
+      return -2;
+    for (c = 0; c < ncols; c++) {
+      ret = arrow_col_init(xls, &cols[c], schema->children[c], array->children[c]);
+      if (ret != 0)
+        return ret;
+      /* Struct slots and child slots differ by the child's own offset */
+      cols[c].offset += array->offset;
+    }
+    if (array->null_count != 0 && array->n_buffers > 0)
+      validity = array->buffers[0];
+  } else {
+    ncols = 1;
+    if (first_col >= xls->xls_colmax)
+      return -2;
+    ret = arrow_col_init(xls, &cols[0], schema, array);
+    if (ret != 0)
+      return ret;
+  }
+
+  if (nrows == 0 || ncols == 0)
+    return 0;
+  if (first_row < 0 || first_row >= xls->xls_rowmax ||
+      nrows > xls->xls_rowmax - first_row)
+    return -2;
+
+  /* Rows are encoded across all columns at once, so neighbouring numeric
+   * columns share MULRK records. */
+  for (r = 0; r < nrows; r++) {
+    struct xl_row *cur;
+
+    i = array->offset + r;
+    if (validity != NULL && !(validity[i >> 3] & (1 << (i & 7))))
+      continue;
+
+    cur = xls_row_begin(xls, first_row + (int)r);
+    if (cur == NULL)
+      return -1;
+
+    ret = xls_row_skip(cur, first_col);
+    for (c = 0; c < ncols && ret == 0; c++)
+      ret = arrow_add_cell(cur, &cols[c], cols[c].offset + r);
+
+    if (ret == 0)
+      ret = xls_row_end(cur);
+    else
+      xls_row_end(cur);
+    if (ret != 0)
+      return ret;
+  }
+
+  return 0;
+}
@@ -47,47 +47,13 @@ void bw_destroy(struct bwctx *bw)
   free(bw);
 }
 
-void reverse(unsigned char *data, int size)
-{
-  unsigned char *t, *m;
-
-  t = data + size;
-  m = data + size / 2;
-  while (data != m) {
-    unsigned char c = *data;
-    *data++ = *--t;
-    *t = c;
-  }
-}
-
-int bw_setbyteorder(struct bwctx *bw)
-{
-  double d = 1.2345;
-  unsigned char data[8];
-  unsigned char hexdata[8] = {0x8D, 0x97, 0x6E, 0x12, 0x83, 0xC0, 0xF3, 0x3F};
-
-  /* Test for endian */
-  memcpy(data, &d, sizeof(data));
-  if (memcmp(data, hexdata, sizeof(data))) {
-    bw->byte_order = 1;
-  } else {
-    reverse(data, sizeof(data));
-    if (memcmp(data, hexdata, sizeof(data))) {
-      bw->byte_order = 0;
-    } else {
-      return -1;
-    }
-  }
-  return 0;
-}
-
 int bw_init(struct bwctx *bw)
 {
   bw->data = NULL;
   bw->datasize = 0;
   bw->_sz = 0;
-  bw_setbyteorder(bw);
-  bw->append = bw_append;
+  bw->_cap = 0;
+  bw->spill = NULL;
 
   return 0;
 }
@@ -95,39 +61,53 @@ int bw_init(struct bwctx *bw)
 #define ROUNDVAL   16
 #define ROUNDUP(n)  (((n)+ROUNDVAL-1)&-ROUNDVAL)
 
-void bw_resize(struct bwctx *bw, size_t size)
+/* Smallest buffer allocated once anything is stored */
+#define BW_MINCAP  256
+
+/* Make sure the buffer can hold at least size bytes.  The capacity at
+ * least doubles each time so that appending record after record costs
+ * amortized O(1) per record rather than a copy of the whole buffer. */
+int bw_resize(struct bwctx *bw, size_t size)
 {
-  if (bw->_sz != size) {
-    if (size > 0) {
-      if (bw->data == NULL)
-        bw->data = malloc(ROUNDUP(1 + size));
-      else
-        bw->data = realloc(bw->data, ROUNDUP(1 + size));
-      bw->_sz = size;
-    } else if (bw->data != NULL) {
-      free(bw->data);
-      bw->data = NULL;
-    }
-  }
+  unsigned char *data;
+  size_t cap;
+
+  if (size <= bw->_cap)
+    return 0;
+
+  cap = (size_t)bw->_cap * 2;
+  if (cap < BW_MINCAP)
+    cap = BW_MINCAP;
+  if (cap < size)
+    cap = ROUNDUP(1 + size);
+  data = realloc(bw->data, cap);
+  if (data == NULL)
+    return -1;
+
+  bw->data = data;
+  bw->_cap = cap;
+  return 0;
 }
 
-void bw_append(void *xlsctx, void *data, size_t size)
+/* Slow path of bw_reserve(), called when the buffer is full. */
+int bw_make_room(struct bwctx *bw, size_t size)
 {
-  struct bwctx *bw = (struct bwctx *)xlsctx;
+  if (bw->spill)
+    return bw->spill(bw, size);
 
-  int len = bw->_sz;
-  bw_resize(bw, len + size);
-  memcpy(bw->data + len, data, size);
-  bw->datasize += size;
+  return bw_resize(bw, bw->_sz + size);
 }
 
-void bw_prepend(struct bwctx *bw, void *data, size_t size)
+void bw_append(struct bwctx *bw, const void *data, size_t size)
 {
-  int len = bw->_sz;
-  bw_resize(bw, len + size);
-  memmove(bw->data + size, bw->data, len);
-  memcpy(bw->data, data, size);
-  bw->datasize += size;
+  unsigned char *p;
+
+  p = bw_reserve(bw, size);
+  if (p == NULL)
+    return;
+
+  memcpy(p, data, size);
+  bw_commit(bw, size);
 }
 
 
@@ -138,7 +118,8 @@ void bw_prepend(struct bwctx *bw, void *data, size_t size)
  * type = 0x0010, Worksheet
  *
  * Writes Excel BOF (Beginning of File) record to indicate the beginning of
- * a stream or substream in the BIFF file
+ * a stream or substream in the BIFF file.  It is appended, so it must be
+ * the first record stored in bw.
  */
 void bw_store_bof(struct bwctx *bw, uint16_t type)
 {
@@ -151,21 +132,21 @@ void bw_store_bof(struct bwctx *bw, uint16_t type)
   uint16_t build = 0x096C;
   uint16_t year = 0x07C9;
 
-  struct pkt *pkt;
+  unsigned char buf[12];
+  struct pkt pkt;
 
-  pkt = pkt_init(12, FIXED_PACKET);
+  pkt_attach(&pkt, buf, sizeof(buf));
 
   /* Construct header */
-  pkt_add16_le(pkt, name);
-  pkt_add16_le(pkt, length);
+  pkt_add16_le(&pkt, name);
+  pkt_add16_le(&pkt, length);
 
   /* Construct data */
-  pkt_add16_le(pkt, g_BIFF_version);
-  pkt_add16_le(pkt, type);
-  pkt_add16_le(pkt, build);
-  pkt_add16_le(pkt, year);
-  bw_prepend(bw, pkt->data, pkt->len);
-  pkt_free(pkt);
+  pkt_add16_le(&pkt, g_BIFF_version);
+  pkt_add16_le(&pkt, type);
+  pkt_add16_le(&pkt, build);
+  pkt_add16_le(&pkt, year);
+  bw_append(bw, pkt.data, pkt.len);
 }
 
 /****************************************************************************
@@ -175,16 +156,17 @@ void bw_store_bof(struct bwctx *bw, uint16_t type)
  */
 void bw_store_eof(struct bwctx *bw)
 {
-  struct pkt *pkt;
   uint16_t name = 0x000A;   /* Record identifier */
   uint16_t length = 0x0000; /* Number of bytes to follow */
+  unsigned char *p;
 
-  pkt = pkt_init(4, FIXED_PACKET);
+  p = bw_reserve(bw, 4);
+  if (p == NULL)
+    return;
 
   /* Construct header */
-  pkt_add16_le(pkt, name);
-  pkt_add16_le(pkt, length);
+  p = xl_put16_le(p, name);
+  p = xl_put16_le(p, length);
 
-  bw->append(bw, pkt->data, pkt->len);
-  pkt_free(pkt);
+  bw_commit(bw, 4);
 }
@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <io.h>
+#define CSV_OPEN_FLAGS (_O_RDONLY | _O_BINARY)
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CSV_OPEN_FLAGS O_RDONLY
+#define CSV_MMAP 1
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "numparse.h"
+#include "xlcsv.h"
+
+/* Read buffer for input that cannot be mapped, doubled whenever a single
+ * field does not fit. */
+#define CSV_BUFSZ (1 << 20)
+
+struct csv_state {
+  struct wsheetctx *xls;
+  struct xl_row *cur;     /* Row being filled, NULL between records */
+  int row;                /* Row of the next record */
+  int first_col;
+  int text_only;
+  char delim;
+  char quote;
+  struct xl_format *fmt;
+};
+
+/* Find the first delimiter, CR or LF in p[0..end), or return end.  Field
+ * bodies are skipped 16 bytes at a time with SSE2. */
+static const char *csv_scan(const char *p, const char *end, char delim)
+{
+#if defined(__SSE2__) && defined(__GNUC__)
+  const __m128i d = _mm_set1_epi8(delim);
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i cr = _mm_set1_epi8('\r');
+
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, d),
+        _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+    int mask = _mm_movemask_epi8(hit);
+
+    if (mask != 0)
+      return p + __builtin_ctz(mask);
+  }
+#endif
+  for (; p < end; p++) {
+    if (*p == delim || *p == '\n' || *p == '\r')
+      return p;
+  }
+
+  return end;
+}
+
+/* Write one field to the current record, starting the record if needed.
+ * Empty fields leave their cell empty. */
+static int csv_field(struct csv_state *st, const char *s, size_t len)
+{
+  double num;
+
+  if (st->cur == NULL) {
+    st->cur = xls_row_begin(st->xls, st->row);
+    if (st->cur == NULL)
+      return st->row < 0 || st->row >= st->xls->xls_rowmax ? -2 : -1;
+    if (xls_row_skip(st->cur, st->first_col) != 0)
+      return -2;
+  }
+
+  if (len == 0) {
+    xls_row_skip(st->cur, 1);
+    return 0;
+  }
+
+  if (!st->text_only && xl_parse_double(s, len, &num))
+    return xls_row_add_number(st->cur, num, st->fmt);
+
+  return xls_row_add_string_n(st->cur, s, len, st->fmt);
+}
+
+static int csv_end_record(struct csv_state *st)
+{
+  int ret = 0;
+
+  if (st->cur != NULL) {
+    ret = xls_row_end(st->cur);
+    st->cur = NULL;
+  }
+  st->row++;
+
+  return ret;
+}
+
+/* Parse the records in buf[0..len).  Unless eof is set, parsing stops in
+ * front of a field whose end is not in the buffer yet and *used is set to
+ * the bytes consumed; the rest must be passed again with more input. */
+static int csv_parse(struct csv_state *st, const char *buf, size_t len, int eof, size_t *used)
+{
+  const char *p = buf, *end = buf + len;
+  char scratch[XLS_STRMAX];
+
+  while (p < end) {
+    const char *s, *t;
+    size_t flen;
+    int ret;
+
+    if (*p == st->quote) {
+      /* Quoted field, "" stands for a quote */
+      const char *q = p + 1, *c;
+      int escaped = 0;
+
+      for (;;) {
+        c = memchr(q, st->quote, end - q);
+        if (!eof && (c == NULL || c + 1 == end))
+          goto incomplete;
+        if (c == NULL) {
+          c = end; /* Unterminated at the end of the input */
+          break;
+        }
+        if (c + 1 < end && c[1] == st->quote) {
+          escaped = 1;
+          q = c + 2;
+          continue;
+        }
+        break;
+      }
+
+      s = p + 1;
+      flen = c - s;
+      if (escaped) {
+        const char *r;
+
+        /* Only the part that fits in a LABEL is kept */
+        for (r = s, flen = 0; r < c && flen < sizeof(scratch); r++) {
+          scratch[flen++] = *r;
+          if (*r == st->quote)
+            r++;
+        }
+        s = scratch;
+      }
+
+      /* Ignore anything between the closing quote and the separator */
+      t = c < end ? csv_scan(c + 1, end, st->delim) : end;
+    } else {
+      s = p;
+      t = csv_scan(p, end, st->delim);
+      flen = t - s;
+    }
+
+    if (!eof && (t == end || (*t == '\r' && t + 1 == end)))
+      goto incomplete;
+
+    ret = csv_field(st, s, flen);
+    if (ret != 0)
+      return ret;
+
+    if (t == end) {
+      p = end;
+    } else if (*t == st->delim) {
+      p = t + 1;
+    } else {
+      p = t + 1 + (*t == '\r' && t + 1 < end && t[1] == '\n');
+      ret = csv_end_record(st);
+      if (ret != 0)
+        return ret;
+    }
+  }
+
+  if (eof && st->cur != NULL)
+    return csv_end_record(st);
+
+  *used = len;
+  return 0;
+
+incomplete:
+  *used = p - buf;
+  return 0;
+}
+
+/* Read the rest of fd in chunks, carrying incomplete fields over */
+static int csv_stream(struct csv_state *st, int fd)
+{
+  size_t size = CSV_BUFSZ, have = 0, used;
+  char *buf;
+  int ret = 0;
+
+  buf = malloc(size);
+  if (buf == NULL)
+    return -1;
+
+  for (;;) {
+    long n;
+    int eof;
+
+    n = read(fd, buf + have, (unsigned int)(size - have));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      ret = -1;
+      break;
+    }
+
+    eof = n == 0;
+    have += n;
+    ret = csv_parse(st, buf, have, eof, &used);
+    if (ret != 0 || eof)
+      break;
+
+    memmove(buf, buf + used, have - used);
+    have -= used;
+
+    if (have == size) {
+      char *tmp = realloc(buf, size * 2);
+
+      if (tmp == NULL) {
+        ret = -1;
+        break;
+      }
+      buf = tmp;
+      size *= 2;
+    }
+  }
+
+  free(buf);
+  return ret;
+}
+
+/* Import CSV data from the current position of fd into the worksheet.
+ * Each record becomes a row, starting at opts->first_row.  Fields that
+ * are decimal numbers are written as numbers, all others as strings
+ * (truncated to 255 characters); empty fields leave the cell empty.
+ * Regular files are mapped into memory, anything else is read in
+ * chunks.  Returns 0, -1 on a read or allocation failure, or -2 if the
+ * data does not fit on the sheet. */
+int xls_import_csv_fd(struct wsheetctx *xls, int fd, const struct xl_csv_options *opts)
+{
+  struct csv_state st;
+#ifdef CSV_MMAP
+  struct stat sb;
+  off_t pos;
+#endif
+
+  st.xls = xls;
+  st.cur = NULL;
+  st.row = opts ? opts->first_row : 0;
+  st.first_col = opts ? opts->first_col : 0;
+  st.text_only = opts ? opts->text_only : 0;
+  st.delim = opts && opts->delimiter ? opts->delimiter : ',';
+  st.quote = opts && opts->quote ? opts->quote : '"';
+  st.fmt = opts ? opts->fmt : NULL;
+
+#ifdef CSV_MMAP
+  pos = lseek(fd, 0, SEEK_CUR);
+  if (pos >= 0 && fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > pos) {
+    void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (map != MAP_FAILED) {
+      size_t used;
+      int ret;
+
+#ifdef MADV_SEQUENTIAL
+      madvise(map, sb.st_size, MADV_SEQUENTIAL);
+#endif
+      ret = csv_parse(&st, (const char *)map + pos, sb.st_size - pos, 1, &used);
+      munmap(map, sb.st_size);
+      lseek(fd, sb.st_size, SEEK_SET);
+      return ret;
+    }
+  }
+#endif
+
+  return csv_stream(&st, fd);
+}
+
+/* Same as xls_import_csv_fd() for the file at path */
+int xls_import_csv(struct wsheetctx *xls, const char *path, const struct xl_csv_options *opts)
+{
+  int fd, ret;
+
+  fd = open(path, CSV_OPEN_FLAGS);
+  if (fd < 0)
+    return -1;
+
+  ret = xls_import_csv_fd(xls, fd, opts);
+  close(fd);
+
+  return ret;
+}
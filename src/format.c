@@ -23,7 +23,20 @@
 #include "format.h"
 #include "stream.h"
 
-static int fmt_get_color(char *colorname);
+static int fmt_get_color(const char *colorname);
+
+/* Copy len bytes of str into a new NUL terminated string */
+static char *fmt_strndup(const char *str, size_t len)
+{
+  char *ret;
+
+  ret = malloc(len + 1);
+  if (ret == NULL)
+    return NULL;
+  memcpy(ret, str, len);
+  ret[len] = '\0';
+  return ret;
+}
 
 struct xl_format * fmt_new(int idx)
 {
@@ -198,7 +211,10 @@ struct pkt *fmt_get_font(struct xl_format *fmt)
   pkt_add8(pkt, fmt->font_charset);    /* Font charset */
   pkt_add8(pkt, 0x00);                 /* Reserved */
   pkt_add8(pkt, cch);                  /* Length of font name (count of ch) */
-  pkt_addraw(pkt, (unsigned char *)fmt->fontname, cch);  /* Fontname */
+  if (pkt_addraw(pkt, (unsigned char *)fmt->fontname, cch) == -1) {  /* Fontname */
+    pkt_free(pkt);
+    return NULL;
+  }
 
   return pkt;
 }
@@ -212,11 +228,11 @@ void fmt_set_bold(struct xl_format *fmt, int bold_val)
 }
 
 struct key_value {
-  char *name;
+  const char *name;
   int value;
 };
 
-void fmt_set_align(struct xl_format *fmt, char *align)
+void fmt_set_align(struct xl_format *fmt, const char *align)
 {
   int i;
   int num_vals;
@@ -259,7 +275,7 @@ void fmt_set_merge(struct xl_format *fmt)
   fmt->text_h_align = 6;
 }
 
-void fmt_set_color(struct xl_format *fmt, char *colorname)
+void fmt_set_color(struct xl_format *fmt, const char *colorname)
 {
   fmt->color = fmt_get_color(colorname);
 }
@@ -269,7 +285,7 @@ void fmt_set_text_wrap(struct xl_format *fmt, int val)
   fmt->text_wrap = val;
 }
 
-void fmt_set_border_color(struct xl_format *fmt, char *colorname)
+void fmt_set_border_color(struct xl_format *fmt, const char *colorname)
 {
   int color;
 
@@ -280,12 +296,12 @@ void fmt_set_border_color(struct xl_format *fmt, char *colorname)
   fmt->right_color = color;
 }
 
-void fmt_set_bg_color(struct xl_format *fmt, char *colorname)
+void fmt_set_bg_color(struct xl_format *fmt, const char *colorname)
 {
   fmt->bg_color = fmt_get_color(colorname);
 }
 
-void fmt_set_fg_color(struct xl_format *fmt, char *colorname)
+void fmt_set_fg_color(struct xl_format *fmt, const char *colorname)
 {
   fmt->fg_color = fmt_get_color(colorname);
 }
@@ -326,11 +342,17 @@ void fmt_set_num_format(struct xl_format *fmt, int format)
   fmt->num_format = format;
 }
 
-void fmt_set_font(struct xl_format *fmt, char *font)
+void fmt_set_font(struct xl_format *fmt, const char *font)
+{
+  fmt_set_font_n(fmt, font, strlen(font));
+}
+
+/* As fmt_set_font() but font need not be NUL terminated */
+void fmt_set_font_n(struct xl_format *fmt, const char *font, size_t len)
 {
   if (fmt->fontname)
     free(fmt->fontname);
-  fmt->fontname = strdup(font);
+  fmt->fontname = fmt_strndup(font, len);
 }
 
 void fmt_set_underline(struct xl_format *fmt, int val)
@@ -338,12 +360,19 @@ void fmt_set_underline(struct xl_format *fmt, int val)
   fmt->underline = val;
 }
 
-void fmt_set_num_format_str(struct xl_format *fmt, char *str)
+void fmt_set_num_format_str(struct xl_format *fmt, const char *str)
 {
-  fmt->num_format_str = strdup(str);
+  fmt_set_num_format_str_n(fmt, str, strlen(str));
+}
+
+/* As fmt_set_num_format_str() but str need not be NUL terminated */
+void fmt_set_num_format_str_n(struct xl_format *fmt, const char *str, size_t len)
+{
+  free(fmt->num_format_str);
+  fmt->num_format_str = fmt_strndup(str, len);
 }
 
-static int fmt_get_color(char *colorname)
+static int fmt_get_color(const char *colorname)
 {
   int num_colors;
   int i;
@@ -375,7 +404,7 @@ static int fmt_get_color(char *colorname)
   return 0x7FFF;
 }
 
-static int fhc(char *str)
+static int fhc(const char *str)
 {
   int hash = 0;
   while (*str)
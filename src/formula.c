@@ -52,6 +52,15 @@ struct token {
 /* Declaration type */
 TAILQ_HEAD(token_list, token);
 
+/* Backing store for the tokens of one formula, so tokenizing needs no
+ * heap.  Token text is packed into text[] NUL terminated. */
+struct token_pool {
+  struct token tokens[FORMULA_MAXTOKENS];
+  int ntokens;
+  char text[FORMULA_MAXTEXT];
+  size_t textlen;
+};
+
 struct xl_functions {
   char *name;
   int code;
@@ -81,7 +90,32 @@ int is_func(char *func)
   return 0;
 }
 
-void tokenize(char *inp, struct token_list *tl)
+/* Take the next token from the pool and append it to the list.  Returns
+ * NULL once the pool is out of tokens or text space. */
+static struct token *new_token(struct token_list *tl, struct token_pool *tp,
+    int type, const char *data)
+{
+  struct token *tn;
+  size_t len;
+
+  if (tp->ntokens == FORMULA_MAXTOKENS)
+    return NULL;
+  tn = &tp->tokens[tp->ntokens];
+  tn->type = type;
+  tn->data = NULL;
+  if (data != NULL) {
+    len = strlen(data) + 1;
+    if (len > sizeof(tp->text) - tp->textlen)
+      return NULL;
+    tn->data = memcpy(tp->text + tp->textlen, data, len);
+    tp->textlen += len;
+  }
+  tp->ntokens++;
+  TAILQ_INSERT_TAIL(tl, tn, tokens);
+  return tn;
+}
+
+int tokenize(char *inp, struct token_list *tl, struct token_pool *pool)
 {
   char token[128];
   int tp;
@@ -100,46 +134,38 @@ void tokenize(char *inp, struct token_list *tl)
 
   while(strpos <= strend) {
     ch = *strpos;
+    if (tp == (int)sizeof(token) - 1)
+      return -1;
     switch (state) {
     case TS_DEFAULT:
       if (ch == '\0') {
         break;
       }
       if (ch == '=') {
-        tn = malloc(sizeof(struct token));
-        tn->type = TOKEN_EQUALS;
-        tn->data = NULL;
-        TAILQ_INSERT_TAIL(tl, tn, tokens);
+        if ((tn = new_token(tl, pool, TOKEN_EQUALS, NULL)) == NULL)
+          return -1;
       } else if (ch == ' ') {
         /* Do nothing */
       } else if (ch == '(') {
-        tn = malloc(sizeof(struct token));
-        tn->type = TOKEN_LPAREN;
-        tn->data = NULL;
-        TAILQ_INSERT_TAIL(tl, tn, tokens);
+        if ((tn = new_token(tl, pool, TOKEN_LPAREN, NULL)) == NULL)
+          return -1;
       } else if (ch == ')') {
-        tn = malloc(sizeof(struct token));
-        tn->type = TOKEN_RPAREN;
-        tn->data = NULL;
-        TAILQ_INSERT_TAIL(tl, tn, tokens);
+        if ((tn = new_token(tl, pool, TOKEN_RPAREN, NULL)) == NULL)
+          return -1;
       } else if (ch == '+' || ch == '-' || ch == '>' || ch == '<' ||
           ch == '*' || ch == '/') {
         /* Special case, check if this is a negative number / cell */
         if (ch == '-' && tn != NULL && tn->type == TOKEN_OPERATOR) {
           token[tp++] = ch;
         } else {
-          tn = malloc(sizeof(struct token));
-          tn->type = TOKEN_OPERATOR;
           token[0] = ch;
           token[1] = '\0';
-          tn->data = strdup(token);
-          TAILQ_INSERT_TAIL(tl, tn, tokens);
+          if ((tn = new_token(tl, pool, TOKEN_OPERATOR, token)) == NULL)
+            return -1;
         }
       } else if (ch == ',') {
-        tn = malloc(sizeof(struct token));
-        tn->type = TOKEN_COMMA;
-        tn->data = NULL;
-        TAILQ_INSERT_TAIL(tl, tn, tokens);
+        if ((tn = new_token(tl, pool, TOKEN_COMMA, NULL)) == NULL)
+          return -1;
       } else if (ch >= 'A' && ch <= 'Z') {
         token[tp++] = ch;
         state = TS_WORD;
@@ -167,21 +193,15 @@ void tokenize(char *inp, struct token_list *tl)
         token[tp] = '\0';
         tp = 0;
         if (is_func(token)) {
-          tn = malloc(sizeof(struct token));
-          tn->type = TOKEN_FUNCTION;
-          tn->data = strdup(token);
-          TAILQ_INSERT_TAIL(tl, tn, tokens);
+          if ((tn = new_token(tl, pool, TOKEN_FUNCTION, token)) == NULL)
+            return -1;
         } else if (strchr(token, ':') != NULL) {
-          tn = malloc(sizeof(struct token));
-          tn->type = TOKEN_CELLRANGE;
-          tn->data = strdup(token);
-          TAILQ_INSERT_TAIL(tl, tn, tokens);
+          if ((tn = new_token(tl, pool, TOKEN_CELLRANGE, token)) == NULL)
+            return -1;
         } else {
           /* Assume it's a cell? */
-          tn = malloc(sizeof(struct token));
-          tn->type = TOKEN_CELL;
-          tn->data = strdup(token);
-          TAILQ_INSERT_TAIL(tl, tn, tokens);
+          if ((tn = new_token(tl, pool, TOKEN_CELL, token)) == NULL)
+            return -1;
         }
         state = TS_DEFAULT;
         continue;
@@ -191,10 +211,8 @@ void tokenize(char *inp, struct token_list *tl)
       if (ch == '"') {
         token[tp] = '\0';
         tp = 0;
-        tn = malloc(sizeof(struct token));
-        tn->type = TOKEN_STRING;
-        tn->data = strdup(token);
-        TAILQ_INSERT_TAIL(tl, tn, tokens);
+        if ((tn = new_token(tl, pool, TOKEN_STRING, token)) == NULL)
+          return -1;
         state = TS_DEFAULT;
       } else
         token[tp++] = ch;
@@ -203,10 +221,8 @@ void tokenize(char *inp, struct token_list *tl)
       if (ch < '0' || ch > '9') {
         token[tp] = '\0';
         tp = 0;
-        tn = malloc(sizeof(struct token));
-        tn->type = TOKEN_NUMBER;
-        tn->data = strdup(token);
-        TAILQ_INSERT_TAIL(tl, tn, tokens);
+        if ((tn = new_token(tl, pool, TOKEN_NUMBER, token)) == NULL)
+          return -1;
         state = TS_DEFAULT;
         continue;
       } else
@@ -215,6 +231,7 @@ void tokenize(char *inp, struct token_list *tl)
     }
     strpos++;
   }
+  return 0;
 }
 
 /* operators
@@ -411,6 +428,9 @@ int parse_token_list(struct token_list *tlist, struct pkt *pkt)
   func_stack[fl].class = 1;
   /* Process one token at a time */
   TAILQ_FOREACH(token, tlist, tokens) {
+    /* Each token pushes at most once onto either stack */
+    if (sl == 32 || fl == 31)
+      return -1;
     /* if it's a number encode it right away */
     if (token->type == TOKEN_NUMBER) {
       encode_number(pkt, token->data);
@@ -572,13 +592,19 @@ static void dump_hex(void *vp, int length)
 int process_formula(char *input, struct pkt *pkt)
 {
   struct token_list tlist;
+  struct token_pool pool;
+#ifdef FORMULA_DEBUG
   struct token *token;
+#endif
 
 #ifdef FORMULA_DEBUG
   printf("Input: %s\n", input);
 #endif
   TAILQ_INIT(&tlist);
-  tokenize(input, &tlist);
+  pool.ntokens = 0;
+  pool.textlen = 0;
+  if (tokenize(input, &tlist, &pool) == -1)
+    return -1;
 #ifdef FORMULA_DEBUG
   printf("---\n");
   TAILQ_FOREACH(token, &tlist, tokens) {
@@ -618,11 +644,5 @@ int process_formula(char *input, struct pkt *pkt)
     }
   }
 #endif
-  parse_token_list(&tlist, pkt);
-  while ((token = TAILQ_FIRST(&tlist))) {
-    TAILQ_REMOVE(&tlist, token, tokens);
-    free(token->data);
-    free(token);
-  }
-  return 0;
+  return parse_token_list(&tlist, pkt);
 }
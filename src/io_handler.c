@@ -36,3 +36,10 @@ int xl_file_close(void *handle)
 {
 	return handle ? fclose((FILE*)handle) : -1;
 }
+
+int xl_file_fileno(void *handle)
+{
+	if (handle == NULL || fflush((FILE*)handle) != 0)
+		return -1;
+	return fileno((FILE*)handle);
+}
@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* A small LZ77 compressor for temporary data, using the LZ4 block layout:
+ * each sequence is a token byte (literal count in the high nibble, match
+ * length - 4 in the low one, 15 meaning more length bytes follow), the
+ * literals, and a two byte little endian match offset.  The last sequence
+ * has literals only.  Matches are found greedily through a hash of the
+ * next four bytes, which suits the repetitive record headers of a BIFF
+ * stream and keeps compression cheap. */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+#define LZ_MINMATCH     4
+#define LZ_HASHLOG      13
+#define LZ_LASTLITERALS 5  /* Bytes at the end that are always literals */
+#define LZ_MFLIMIT      12 /* No match may start this close to the end */
+#define LZ_WILDCOPY     8
+
+static uint32_t lz_read32(const unsigned char *p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static unsigned int lz_hash(uint32_t v)
+{
+  return (v * 2654435761U) >> (32 - LZ_HASHLOG);
+}
+
+/* Copy len bytes in whole words, writing up to LZ_WILDCOPY bytes past the
+ * end.  Source and destination may overlap as long as they are at least
+ * LZ_WILDCOPY apart. */
+static void lz_wildcopy(unsigned char *op, const unsigned char *ip, size_t len)
+{
+  unsigned char *end = op + len;
+
+  do {
+    memcpy(op, ip, LZ_WILDCOPY);
+    op += LZ_WILDCOPY;
+    ip += LZ_WILDCOPY;
+  } while (op < end);
+}
+
+/* Store the part of a length that did not fit in its nibble */
+static unsigned char *lz_putlen(unsigned char *op, size_t len)
+{
+  while (len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = (unsigned char)len;
+  return op;
+}
+
+static unsigned char *lz_literals(unsigned char *op, const unsigned char *lit, size_t len, unsigned char **token)
+{
+  *token = op++;
+  if (len >= 15) {
+    **token = 15 << 4;
+    op = lz_putlen(op, len - 15);
+  } else {
+    **token = (unsigned char)(len << 4);
+  }
+  memcpy(op, lit, len);
+  return op + len;
+}
+
+/* Compress n bytes, at most XL_LZ_MAXBLOCK, into dst, which must have room
+ * for XL_LZ_BOUND(n).  Returns the compressed size, or 0 if the arguments
+ * are out of range. */
+size_t xl_lz_compress(const void *src, size_t n, void *dst, size_t cap)
+{
+  const unsigned char *base = src;
+  const unsigned char *iend = base + n;
+  const unsigned char *ip = base;
+  const unsigned char *anchor = base;
+  unsigned char *op = dst;
+  unsigned char *token;
+  uint16_t table[1 << LZ_HASHLOG];
+
+  if (n > XL_LZ_MAXBLOCK || cap < XL_LZ_BOUND(n))
+    return 0;
+
+  if (n > LZ_MFLIMIT) {
+    const unsigned char *mflimit = iend - LZ_MFLIMIT;
+    const unsigned char *mlimit = iend - LZ_LASTLITERALS;
+
+    memset(table, 0, sizeof(table));
+    ip++;
+
+    while (ip < mflimit) {
+      const unsigned char *ref, *mp;
+      uint32_t seq = lz_read32(ip);
+      unsigned int h = lz_hash(seq);
+      size_t off, mlen;
+
+      ref = base + table[h];
+      table[h] = (uint16_t)(ip - base);
+      if (lz_read32(ref) != seq) {
+        ip++;
+        continue;
+      }
+
+      /* Grow the match in both directions */
+      while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+        ip--;
+        ref--;
+      }
+      mp = ip + LZ_MINMATCH;
+      while (mp < mlimit && *mp == ref[mp - ip])
+        mp++;
+
+      op = lz_literals(op, anchor, ip - anchor, &token);
+
+      off = ip - ref;
+      *op++ = (unsigned char)off;
+      *op++ = (unsigned char)(off >> 8);
+
+      mlen = mp - ip - LZ_MINMATCH;
+      if (mlen >= 15) {
+        *token |= 15;
+        op = lz_putlen(op, mlen - 15);
+      } else {
+        *token |= (unsigned char)mlen;
+      }
+
+      ip = anchor = mp;
+      if (ip < mflimit)
+        table[lz_hash(lz_read32(ip - 2))] = (uint16_t)(ip - 2 - base);
+    }
+  }
+
+  op = lz_literals(op, anchor, iend - anchor, &token);
+  return op - (unsigned char *)dst;
+}
+
+/* Decompress n bytes into dst, which has room for cap.  Returns the size
+ * of the data, or 0 if the input is malformed or does not fit. */
+size_t xl_lz_decompress(const void *src, size_t n, void *dst, size_t cap)
+{
+  const unsigned char *ip = src;
+  const unsigned char *iend = ip + n;
+  unsigned char *op = dst;
+  unsigned char *oend = op + cap;
+
+  while (ip < iend) {
+    unsigned int token = *ip++;
+    const unsigned char *ref;
+    size_t len, off;
+    unsigned int b;
+
+    len = token >> 4;
+    if (len == 15) {
+      do {
+        if (ip >= iend)
+          return 0;
+        b = *ip++;
+        len += b;
+      } while (b == 255);
+    }
+    if ((size_t)(iend - ip) < len || (size_t)(oend - op) < len)
+      return 0;
+    if ((size_t)(iend - ip) >= len + LZ_WILDCOPY && (size_t)(oend - op) >= len + LZ_WILDCOPY)
+      lz_wildcopy(op, ip, len);
+    else
+      memcpy(op, ip, len);
+    op += len;
+    ip += len;
+
+    /* The last sequence ends after its literals */
+    if (ip == iend)
+      break;
+
+    if (iend - ip < 2)
+      return 0;
+    off = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (off == 0 || off > (size_t)(op - (unsigned char *)dst))
+      return 0;
+
+    len = token & 15;
+    if (len == 15) {
+      do {
+        if (ip >= iend)
+          return 0;
+        b = *ip++;
+        len += b;
+      } while (b == 255);
+    }
+    len += LZ_MINMATCH;
+    if ((size_t)(oend - op) < len)
+      return 0;
+
+    /* Matches may overlap what they produce */
+    ref = op - off;
+    if (off >= LZ_WILDCOPY && (size_t)(oend - op) >= len + LZ_WILDCOPY) {
+      lz_wildcopy(op, ref, len);
+      op += len;
+    } else if (off >= len) {
+      memcpy(op, ref, len);
+      op += len;
+    } else {
+      while (len--)
+        *op++ = *ref++;
+    }
+  }
+
+  return op - (unsigned char *)dst;
+}
@@ -0,0 +1,576 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <locale.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "numparse.h"
+#include "stream.h"
+
+/* Longest number copied to the stack for strtod() when the fast paths
+ * cannot be used; longer ones are copied to the heap */
+#define NUMPARSE_MAXLEN 64
+
+/* Longest decimal point of a locale that strtod() is given */
+#define NUMPARSE_MAXPOINT 8
+
+/* Powers of ten that are exact doubles */
+static const double pow10_exact[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* The top 128 bits of 10^e, normalised so the high bit is set and
+ * rounded down, for e in [NUMPARSE_MINEXP, NUMPARSE_MAXEXP].  Numbers
+ * beyond this range are rare enough to leave to strtod(). */
+#define NUMPARSE_MINEXP -64
+#define NUMPARSE_MAXEXP 64
+
+static const uint64_t pow10_128[][2] = {
+  { 0xA87FEA27A539E9A5ULL, 0x3F2398D747B36224ULL }, /* 1e-64 */
+  { 0xD29FE4B18E88640EULL, 0x8EEC7F0D19A03AADULL }, /* 1e-63 */
+  { 0x83A3EEEEF9153E89ULL, 0x1953CF68300424ACULL }, /* 1e-62 */
+  { 0xA48CEAAAB75A8E2BULL, 0x5FA8C3423C052DD7ULL }, /* 1e-61 */
+  { 0xCDB02555653131B6ULL, 0x3792F412CB06794DULL }, /* 1e-60 */
+  { 0x808E17555F3EBF11ULL, 0xE2BBD88BBEE40BD0ULL }, /* 1e-59 */
+  { 0xA0B19D2AB70E6ED6ULL, 0x5B6ACEAEAE9D0EC4ULL }, /* 1e-58 */
+  { 0xC8DE047564D20A8BULL, 0xF245825A5A445275ULL }, /* 1e-57 */
+  { 0xFB158592BE068D2EULL, 0xEED6E2F0F0D56712ULL }, /* 1e-56 */
+  { 0x9CED737BB6C4183DULL, 0x55464DD69685606BULL }, /* 1e-55 */
+  { 0xC428D05AA4751E4CULL, 0xAA97E14C3C26B886ULL }, /* 1e-54 */
+  { 0xF53304714D9265DFULL, 0xD53DD99F4B3066A8ULL }, /* 1e-53 */
+  { 0x993FE2C6D07B7FABULL, 0xE546A8038EFE4029ULL }, /* 1e-52 */
+  { 0xBF8FDB78849A5F96ULL, 0xDE98520472BDD033ULL }, /* 1e-51 */
+  { 0xEF73D256A5C0F77CULL, 0x963E66858F6D4440ULL }, /* 1e-50 */
+  { 0x95A8637627989AADULL, 0xDDE7001379A44AA8ULL }, /* 1e-49 */
+  { 0xBB127C53B17EC159ULL, 0x5560C018580D5D52ULL }, /* 1e-48 */
+  { 0xE9D71B689DDE71AFULL, 0xAAB8F01E6E10B4A6ULL }, /* 1e-47 */
+  { 0x9226712162AB070DULL, 0xCAB3961304CA70E8ULL }, /* 1e-46 */
+  { 0xB6B00D69BB55C8D1ULL, 0x3D607B97C5FD0D22ULL }, /* 1e-45 */
+  { 0xE45C10C42A2B3B05ULL, 0x8CB89A7DB77C506AULL }, /* 1e-44 */
+  { 0x8EB98A7A9A5B04E3ULL, 0x77F3608E92ADB242ULL }, /* 1e-43 */
+  { 0xB267ED1940F1C61CULL, 0x55F038B237591ED3ULL }, /* 1e-42 */
+  { 0xDF01E85F912E37A3ULL, 0x6B6C46DEC52F6688ULL }, /* 1e-41 */
+  { 0x8B61313BBABCE2C6ULL, 0x2323AC4B3B3DA015ULL }, /* 1e-40 */
+  { 0xAE397D8AA96C1B77ULL, 0xABEC975E0A0D081AULL }, /* 1e-39 */
+  { 0xD9C7DCED53C72255ULL, 0x96E7BD358C904A21ULL }, /* 1e-38 */
+  { 0x881CEA14545C7575ULL, 0x7E50D64177DA2E54ULL }, /* 1e-37 */
+  { 0xAA242499697392D2ULL, 0xDDE50BD1D5D0B9E9ULL }, /* 1e-36 */
+  { 0xD4AD2DBFC3D07787ULL, 0x955E4EC64B44E864ULL }, /* 1e-35 */
+  { 0x84EC3C97DA624AB4ULL, 0xBD5AF13BEF0B113EULL }, /* 1e-34 */
+  { 0xA6274BBDD0FADD61ULL, 0xECB1AD8AEACDD58EULL }, /* 1e-33 */
+  { 0xCFB11EAD453994BAULL, 0x67DE18EDA5814AF2ULL }, /* 1e-32 */
+  { 0x81CEB32C4B43FCF4ULL, 0x80EACF948770CED7ULL }, /* 1e-31 */
+  { 0xA2425FF75E14FC31ULL, 0xA1258379A94D028DULL }, /* 1e-30 */
+  { 0xCAD2F7F5359A3B3EULL, 0x096EE45813A04330ULL }, /* 1e-29 */
+  { 0xFD87B5F28300CA0DULL, 0x8BCA9D6E188853FCULL }, /* 1e-28 */
+  { 0x9E74D1B791E07E48ULL, 0x775EA264CF55347DULL }, /* 1e-27 */
+  { 0xC612062576589DDAULL, 0x95364AFE032A819DULL }, /* 1e-26 */
+  { 0xF79687AED3EEC551ULL, 0x3A83DDBD83F52204ULL }, /* 1e-25 */
+  { 0x9ABE14CD44753B52ULL, 0xC4926A9672793542ULL }, /* 1e-24 */
+  { 0xC16D9A0095928A27ULL, 0x75B7053C0F178293ULL }, /* 1e-23 */
+  { 0xF1C90080BAF72CB1ULL, 0x5324C68B12DD6338ULL }, /* 1e-22 */
+  { 0x971DA05074DA7BEEULL, 0xD3F6FC16EBCA5E03ULL }, /* 1e-21 */
+  { 0xBCE5086492111AEAULL, 0x88F4BB1CA6BCF584ULL }, /* 1e-20 */
+  { 0xEC1E4A7DB69561A5ULL, 0x2B31E9E3D06C32E5ULL }, /* 1e-19 */
+  { 0x9392EE8E921D5D07ULL, 0x3AFF322E62439FCFULL }, /* 1e-18 */
+  { 0xB877AA3236A4B449ULL, 0x09BEFEB9FAD487C2ULL }, /* 1e-17 */
+  { 0xE69594BEC44DE15BULL, 0x4C2EBE687989A9B3ULL }, /* 1e-16 */
+  { 0x901D7CF73AB0ACD9ULL, 0x0F9D37014BF60A10ULL }, /* 1e-15 */
+  { 0xB424DC35095CD80FULL, 0x538484C19EF38C94ULL }, /* 1e-14 */
+  { 0xE12E13424BB40E13ULL, 0x2865A5F206B06FB9ULL }, /* 1e-13 */
+  { 0x8CBCCC096F5088CBULL, 0xF93F87B7442E45D3ULL }, /* 1e-12 */
+  { 0xAFEBFF0BCB24AAFEULL, 0xF78F69A51539D748ULL }, /* 1e-11 */
+  { 0xDBE6FECEBDEDD5BEULL, 0xB573440E5A884D1BULL }, /* 1e-10 */
+  { 0x89705F4136B4A597ULL, 0x31680A88F8953030ULL }, /* 1e-9 */
+  { 0xABCC77118461CEFCULL, 0xFDC20D2B36BA7C3DULL }, /* 1e-8 */
+  { 0xD6BF94D5E57A42BCULL, 0x3D32907604691B4CULL }, /* 1e-7 */
+  { 0x8637BD05AF6C69B5ULL, 0xA63F9A49C2C1B10FULL }, /* 1e-6 */
+  { 0xA7C5AC471B478423ULL, 0x0FCF80DC33721D53ULL }, /* 1e-5 */
+  { 0xD1B71758E219652BULL, 0xD3C36113404EA4A8ULL }, /* 1e-4 */
+  { 0x83126E978D4FDF3BULL, 0x645A1CAC083126E9ULL }, /* 1e-3 */
+  { 0xA3D70A3D70A3D70AULL, 0x3D70A3D70A3D70A3ULL }, /* 1e-2 */
+  { 0xCCCCCCCCCCCCCCCCULL, 0xCCCCCCCCCCCCCCCCULL }, /* 1e-1 */
+  { 0x8000000000000000ULL, 0x0000000000000000ULL }, /* 1e0 */
+  { 0xA000000000000000ULL, 0x0000000000000000ULL }, /* 1e1 */
+  { 0xC800000000000000ULL, 0x0000000000000000ULL }, /* 1e2 */
+  { 0xFA00000000000000ULL, 0x0000000000000000ULL }, /* 1e3 */
+  { 0x9C40000000000000ULL, 0x0000000000000000ULL }, /* 1e4 */
+  { 0xC350000000000000ULL, 0x0000000000000000ULL }, /* 1e5 */
+  { 0xF424000000000000ULL, 0x0000000000000000ULL }, /* 1e6 */
+  { 0x9896800000000000ULL, 0x0000000000000000ULL }, /* 1e7 */
+  { 0xBEBC200000000000ULL, 0x0000000000000000ULL }, /* 1e8 */
+  { 0xEE6B280000000000ULL, 0x0000000000000000ULL }, /* 1e9 */
+  { 0x9502F90000000000ULL, 0x0000000000000000ULL }, /* 1e10 */
+  { 0xBA43B74000000000ULL, 0x0000000000000000ULL }, /* 1e11 */
+  { 0xE8D4A51000000000ULL, 0x0000000000000000ULL }, /* 1e12 */
+  { 0x9184E72A00000000ULL, 0x0000000000000000ULL }, /* 1e13 */
+  { 0xB5E620F480000000ULL, 0x0000000000000000ULL }, /* 1e14 */
+  { 0xE35FA931A0000000ULL, 0x0000000000000000ULL }, /* 1e15 */
+  { 0x8E1BC9BF04000000ULL, 0x0000000000000000ULL }, /* 1e16 */
+  { 0xB1A2BC2EC5000000ULL, 0x0000000000000000ULL }, /* 1e17 */
+  { 0xDE0B6B3A76400000ULL, 0x0000000000000000ULL }, /* 1e18 */
+  { 0x8AC7230489E80000ULL, 0x0000000000000000ULL }, /* 1e19 */
+  { 0xAD78EBC5AC620000ULL, 0x0000000000000000ULL }, /* 1e20 */
+  { 0xD8D726B7177A8000ULL, 0x0000000000000000ULL }, /* 1e21 */
+  { 0x878678326EAC9000ULL, 0x0000000000000000ULL }, /* 1e22 */
+  { 0xA968163F0A57B400ULL, 0x0000000000000000ULL }, /* 1e23 */
+  { 0xD3C21BCECCEDA100ULL, 0x0000000000000000ULL }, /* 1e24 */
+  { 0x84595161401484A0ULL, 0x0000000000000000ULL }, /* 1e25 */
+  { 0xA56FA5B99019A5C8ULL, 0x0000000000000000ULL }, /* 1e26 */
+  { 0xCECB8F27F4200F3AULL, 0x0000000000000000ULL }, /* 1e27 */
+  { 0x813F3978F8940984ULL, 0x4000000000000000ULL }, /* 1e28 */
+  { 0xA18F07D736B90BE5ULL, 0x5000000000000000ULL }, /* 1e29 */
+  { 0xC9F2C9CD04674EDEULL, 0xA400000000000000ULL }, /* 1e30 */
+  { 0xFC6F7C4045812296ULL, 0x4D00000000000000ULL }, /* 1e31 */
+  { 0x9DC5ADA82B70B59DULL, 0xF020000000000000ULL }, /* 1e32 */
+  { 0xC5371912364CE305ULL, 0x6C28000000000000ULL }, /* 1e33 */
+  { 0xF684DF56C3E01BC6ULL, 0xC732000000000000ULL }, /* 1e34 */
+  { 0x9A130B963A6C115CULL, 0x3C7F400000000000ULL }, /* 1e35 */
+  { 0xC097CE7BC90715B3ULL, 0x4B9F100000000000ULL }, /* 1e36 */
+  { 0xF0BDC21ABB48DB20ULL, 0x1E86D40000000000ULL }, /* 1e37 */
+  { 0x96769950B50D88F4ULL, 0x1314448000000000ULL }, /* 1e38 */
+  { 0xBC143FA4E250EB31ULL, 0x17D955A000000000ULL }, /* 1e39 */
+  { 0xEB194F8E1AE525FDULL, 0x5DCFAB0800000000ULL }, /* 1e40 */
+  { 0x92EFD1B8D0CF37BEULL, 0x5AA1CAE500000000ULL }, /* 1e41 */
+  { 0xB7ABC627050305ADULL, 0xF14A3D9E40000000ULL }, /* 1e42 */
+  { 0xE596B7B0C643C719ULL, 0x6D9CCD05D0000000ULL }, /* 1e43 */
+  { 0x8F7E32CE7BEA5C6FULL, 0xE4820023A2000000ULL }, /* 1e44 */
+  { 0xB35DBF821AE4F38BULL, 0xDDA2802C8A800000ULL }, /* 1e45 */
+  { 0xE0352F62A19E306EULL, 0xD50B2037AD200000ULL }, /* 1e46 */
+  { 0x8C213D9DA502DE45ULL, 0x4526F422CC340000ULL }, /* 1e47 */
+  { 0xAF298D050E4395D6ULL, 0x9670B12B7F410000ULL }, /* 1e48 */
+  { 0xDAF3F04651D47B4CULL, 0x3C0CDD765F114000ULL }, /* 1e49 */
+  { 0x88D8762BF324CD0FULL, 0xA5880A69FB6AC800ULL }, /* 1e50 */
+  { 0xAB0E93B6EFEE0053ULL, 0x8EEA0D047A457A00ULL }, /* 1e51 */
+  { 0xD5D238A4ABE98068ULL, 0x72A4904598D6D880ULL }, /* 1e52 */
+  { 0x85A36366EB71F041ULL, 0x47A6DA2B7F864750ULL }, /* 1e53 */
+  { 0xA70C3C40A64E6C51ULL, 0x999090B65F67D924ULL }, /* 1e54 */
+  { 0xD0CF4B50CFE20765ULL, 0xFFF4B4E3F741CF6DULL }, /* 1e55 */
+  { 0x82818F1281ED449FULL, 0xBFF8F10E7A8921A4ULL }, /* 1e56 */
+  { 0xA321F2D7226895C7ULL, 0xAFF72D52192B6A0DULL }, /* 1e57 */
+  { 0xCBEA6F8CEB02BB39ULL, 0x9BF4F8A69F764490ULL }, /* 1e58 */
+  { 0xFEE50B7025C36A08ULL, 0x02F236D04753D5B4ULL }, /* 1e59 */
+  { 0x9F4F2726179A2245ULL, 0x01D762422C946590ULL }, /* 1e60 */
+  { 0xC722F0EF9D80AAD6ULL, 0x424D3AD2B7B97EF5ULL }, /* 1e61 */
+  { 0xF8EBAD2B84E0D58BULL, 0xD2E0898765A7DEB2ULL }, /* 1e62 */
+  { 0x9B934C3B330C8577ULL, 0x63CC55F49F88EB2FULL }, /* 1e63 */
+  { 0xC2781F49FFCFA6D5ULL, 0x3CBF6B71C76B25FBULL }  /* 1e64 */
+};
+
+/* 64 x 64 -> 128 bit multiplication */
+static void numparse_mul(uint64_t a, uint64_t b, uint64_t *hi, uint64_t *lo)
+{
+#if defined(__SIZEOF_INT128__)
+  unsigned __int128 r = (unsigned __int128)a * b;
+
+  *hi = (uint64_t)(r >> 64);
+  *lo = (uint64_t)r;
+#else
+  uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+  uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+  uint64_t p0 = a_lo * b_lo, p1 = a_lo * b_hi, p2 = a_hi * b_lo, p3 = a_hi * b_hi;
+  uint64_t mid = (p0 >> 32) + (uint32_t)p1 + (uint32_t)p2;
+
+  *lo = (mid << 32) | (uint32_t)p0;
+  *hi = p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+#endif
+}
+
+static int numparse_clz(uint64_t x)
+{
+#if defined(__GNUC__)
+  return __builtin_clzll(x);
+#else
+  int n = 0;
+
+  while (!(x & 0x8000000000000000ULL)) {
+    x <<= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+/* Correctly rounded man * 10^exp10 for a non-zero man, using the
+ * Eisel-Lemire algorithm.  Returns 0 in the rare cases it cannot decide
+ * the rounding, or for results that are subnormal or overflow. */
+static int numparse_eisel_lemire(uint64_t man, int exp10, int neg, double *out)
+{
+  const uint64_t *pow;
+  uint64_t hi, lo, mant, bits;
+  uint64_t exp2;
+  int clz, msb;
+
+  if (exp10 < NUMPARSE_MINEXP || exp10 > NUMPARSE_MAXEXP)
+    return 0;
+  pow = pow10_128[exp10 - NUMPARSE_MINEXP];
+
+  /* Normalise the mantissa; 217706 / 2^16 approximates log2(10) */
+  clz = numparse_clz(man);
+  man <<= clz;
+  exp2 = (uint64_t)(((217706 * exp10) >> 16) + 64 + 1023) - clz;
+
+  numparse_mul(man, pow[0], &hi, &lo);
+
+  /* Widen to the full 128 bit power when the low bits are ambiguous */
+  if ((hi & 0x1FF) == 0x1FF && lo + man < man) {
+    uint64_t yhi, ylo, mhi = hi, mlo;
+
+    numparse_mul(man, pow[1], &yhi, &ylo);
+    mlo = lo + yhi;
+    if (mlo < lo)
+      mhi++;
+    if ((mhi & 0x1FF) == 0x1FF && mlo + 1 == 0 && ylo + man < man)
+      return 0;
+    hi = mhi;
+    lo = mlo;
+  }
+
+  /* Keep 54 bits, then round to 53 */
+  msb = (int)(hi >> 63);
+  mant = hi >> (msb + 9);
+  exp2 -= 1 ^ msb;
+
+  /* Exactly halfway between two doubles */
+  if (lo == 0 && (hi & 0x1FF) == 0 && (mant & 3) == 1)
+    return 0;
+
+  mant += mant & 1;
+  mant >>= 1;
+  if (mant >> 53) {
+    mant >>= 1;
+    exp2++;
+  }
+
+  /* Subnormal, infinite or NaN */
+  if (exp2 - 1 >= 0x7FF - 1)
+    return 0;
+
+  bits = (exp2 << 52) | (mant & 0x000FFFFFFFFFFFFFULL);
+  if (neg)
+    bits |= 0x8000000000000000ULL;
+  memcpy(out, &bits, sizeof(bits));
+
+  return 1;
+}
+
+/* Eight ASCII digits at once, from Lemire's fast_float.  The bytes are
+ * loaded little endian so the first character is the lowest byte. */
+static uint64_t numparse_load8(const char *p)
+{
+  uint64_t v;
+
+  memcpy(&v, p, sizeof(v));
+#ifdef XL_BIG_ENDIAN
+  v = ((v & 0x00000000FFFFFFFFULL) << 32) | ((v & 0xFFFFFFFF00000000ULL) >> 32);
+  v = ((v & 0x0000FFFF0000FFFFULL) << 16) | ((v & 0xFFFF0000FFFF0000ULL) >> 16);
+  v = ((v & 0x00FF00FF00FF00FFULL) << 8) | ((v & 0xFF00FF00FF00FF00ULL) >> 8);
+#endif
+  return v;
+}
+
+static int numparse_is8digits(uint64_t v)
+{
+  return !(((v + 0x4646464646464646ULL) | (v - 0x3030303030303030ULL)) & 0x8080808080808080ULL);
+}
+
+static uint32_t numparse_parse8(uint64_t v)
+{
+  const uint64_t mask = 0x000000FF000000FFULL;
+  const uint64_t mul1 = 0x000F424000000064ULL; /* 100 + (1000000 << 32) */
+  const uint64_t mul2 = 0x0000271000000001ULL; /* 1 + (10000 << 32) */
+
+  v -= 0x3030303030303030ULL;
+  v = (v * 10) + (v >> 8);
+  v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+  return (uint32_t)v;
+}
+
+/* Accumulate the run of digits at *pp into *mant, returning how many */
+static size_t numparse_digits(const char **pp, const char *end, uint64_t *mant)
+{
+  const char *p = *pp, *start = p;
+  uint64_t m = *mant;
+
+  while (end - p >= 8 && numparse_is8digits(numparse_load8(p))) {
+    m = m * 100000000 + numparse_parse8(numparse_load8(p));
+    p += 8;
+  }
+  while (p < end && (unsigned)(*p - '0') < 10) {
+    m = m * 10 + (*p - '0');
+    p++;
+  }
+
+  *pp = p;
+  *mant = m;
+  return p - start;
+}
+
+/* Parse s[0..len) as a decimal number: an optional sign, digits with an
+ * optional decimal point and an optional exponent.  Nothing else may
+ * surround it.  Returns 1 and sets out on success, 0 if s is not a
+ * number.
+ *
+ * When the digits fit in 53 bits and the power of ten is exact, a single
+ * multiplication or division is correctly rounded (Clinger's fast path).
+ * Up to 19 digits with a moderate exponent go through Eisel-Lemire.
+ * Anything else is copied, to the stack or for long input to the heap,
+ * and handed to strtod() with the '.' swapped for the decimal point of
+ * the current locale. */
+int xl_parse_double(const char *s, size_t len, double *out)
+{
+  const char *p = s, *end = s + len, *digits;
+  uint64_t mant = 0;
+  size_t nint, nfrac = 0, nsig;
+  long exp10 = 0;
+  int neg = 0;
+
+  if (p < end && (*p == '-' || *p == '+')) {
+    neg = *p == '-';
+    p++;
+  }
+
+  digits = p;
+  nint = numparse_digits(&p, end, &mant);
+
+  if (p < end && *p == '.') {
+    p++;
+    nfrac = numparse_digits(&p, end, &mant);
+    exp10 = -(long)nfrac;
+  }
+
+  if (nint + nfrac == 0)
+    return 0;
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    long e = 0;
+    int eneg = 0;
+    const char *estart;
+
+    p++;
+    if (p < end && (*p == '-' || *p == '+')) {
+      eneg = *p == '-';
+      p++;
+    }
+    for (estart = p; p < end && (unsigned)(*p - '0') < 10; p++) {
+      if (e < 100000)
+        e = e * 10 + (*p - '0');
+    }
+    if (p == estart)
+      return 0;
+    exp10 += eneg ? -e : e;
+  }
+
+  if (p != end)
+    return 0;
+
+  /* Leading zeros do not count towards the 19 digits mant can hold */
+  nsig = nint + nfrac;
+  if (nsig > 19) {
+    const char *z;
+
+    for (z = digits; z < end && (*z == '0' || *z == '.'); z++) {
+      if (*z == '0')
+        nsig--;
+    }
+  }
+
+  if (nsig <= 19) {
+    if (mant <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+      double v = (double)mant;
+
+      if (exp10 < 0)
+        v /= pow10_exact[-exp10];
+      else
+        v *= pow10_exact[exp10];
+      *out = neg ? -v : v;
+      return 1;
+    }
+
+    if (mant != 0 && numparse_eisel_lemire(mant, (int)exp10, neg, out))
+      return 1;
+  }
+
+  /* Slow path for long mantissas and large exponents */
+  {
+    char stackbuf[NUMPARSE_MAXLEN + NUMPARSE_MAXPOINT];
+    char *buf = stackbuf;
+    const char *point = localeconv()->decimal_point;
+    size_t n = 0, plen = strlen(point);
+    char *endp;
+    int ok;
+
+    if (plen == 0 || plen > NUMPARSE_MAXPOINT)
+      return 0;
+    /* There is at most one '.', so len + NUMPARSE_MAXPOINT always fits */
+    if (len >= NUMPARSE_MAXLEN) {
+      buf = malloc(len + NUMPARSE_MAXPOINT);
+      if (buf == NULL)
+        return 0;
+    }
+    for (p = s; p < end; p++) {
+      if (*p == '.') {
+        memcpy(buf + n, point, plen);
+        n += plen;
+      } else {
+        buf[n++] = *p;
+      }
+    }
+    buf[n] = '\0';
+
+    *out = strtod(buf, &endp);
+    /* Overflow is not a number we can store */
+    ok = endp == buf + n && isfinite(*out);
+    if (buf != stackbuf)
+      free(buf);
+    return ok;
+  }
+}
+
+/* Parse n digits at s into *v */
+static int numparse_fixed(const char *s, int n, int *v)
+{
+  int i, r = 0;
+
+  for (i = 0; i < n; i++) {
+    if ((unsigned)(s[i] - '0') >= 10)
+      return 0;
+    r = r * 10 + (s[i] - '0');
+  }
+
+  *v = r;
+  return 1;
+}
+
+/* Days from 1970-01-01 to a date of the proleptic Gregorian calendar */
+static long numparse_days(int y, int m, int d)
+{
+  long era, yoe, doy, doe;
+
+  y -= m <= 2;
+  era = y / 400;
+  yoe = y - era * 400;
+  doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+  return era * 146097 + doe - 719468;
+}
+
+/* Parse an ISO 8601 date, YYYY-MM-DD, into an Excel serial number */
+static int numparse_date(const char *s, double *out)
+{
+  static const int mdays[] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  int y, m, d;
+  double serial;
+
+  if (s[4] != '-' || s[7] != '-')
+    return 0;
+  if (!numparse_fixed(s, 4, &y) || !numparse_fixed(s + 5, 2, &m) || !numparse_fixed(s + 8, 2, &d))
+    return 0;
+  if (y < 1900 || m < 1 || m > 12 || d < 1 || d > mdays[m - 1])
+    return 0;
+  if (m == 2 && d == 29 && !(y % 4 == 0 && (y % 100 != 0 || y % 400 == 0)))
+    return 0;
+
+  /* Excel counts from 1900-01-01 as day 1 but believes 1900 was a leap
+   * year, so dates before March 1900 are one day off from the rest. */
+  serial = 25569.0 + numparse_days(y, m, d);
+  if (serial < 61)
+    serial--;
+
+  *out = serial;
+  return 1;
+}
+
+/* Parse a time of day, H:MM, HH:MM, HH:MM:SS or HH:MM:SS.fff, followed
+ * by an optional Z, into a fraction of a day */
+static int numparse_time(const char *s, size_t len, double *out)
+{
+  const char *p = s, *end = s + len;
+  int h, m, sec = 0, hlen;
+  double frac = 0, scale = 0.1;
+
+  if (end > p && end[-1] == 'Z')
+    end--;
+
+  hlen = (end - p > 1 && p[1] == ':') ? 1 : 2;
+  if (end - p < hlen + 3 || p[hlen] != ':')
+    return 0;
+  if (!numparse_fixed(p, hlen, &h) || !numparse_fixed(p + hlen + 1, 2, &m))
+    return 0;
+  p += hlen + 3;
+
+  if (p < end) {
+    if (end - p < 3 || *p != ':' || !numparse_fixed(p + 1, 2, &sec))
+      return 0;
+    p += 3;
+    if (p < end) {
+      if (*p != '.' || p + 1 == end)
+        return 0;
+      for (p++; p < end; p++, scale /= 10) {
+        if ((unsigned)(*p - '0') >= 10)
+          return 0;
+        frac += (*p - '0') * scale;
+      }
+    }
+  }
+
+  if (h > 23 || m > 59 || sec > 59)
+    return 0;
+
+  *out = (h * 3600 + m * 60 + sec + frac) / 86400.0;
+  return 1;
+}
+
+/* Work out what the text s[0..len) holds: a number, a percentage, an
+ * ISO 8601 date, date and time, or time of day, or anything else.  Sets
+ * out to the value to store for everything but XL_TEXT_STRING; dates
+ * and times become Excel serial numbers. */
+int xl_parse_text(const char *s, size_t len, double *out)
+{
+  double t;
+
+  /* Every non-string starts with a digit, a sign or a decimal point */
+  if (len == 0 || !((unsigned)(s[0] - '0') < 10 || s[0] == '-' || s[0] == '+' || s[0] == '.'))
+    return XL_TEXT_STRING;
+
+  if (xl_parse_double(s, len, out))
+    return XL_TEXT_NUMBER;
+
+  if (s[len - 1] == '%' && xl_parse_double(s, len - 1, out)) {
+    *out /= 100;
+    return XL_TEXT_PERCENT;
+  }
+
+  if (len >= 10 && s[4] == '-' && numparse_date(s, out)) {
+    if (len == 10)
+      return XL_TEXT_DATE;
+    if ((s[10] == 'T' || s[10] == ' ') && numparse_time(s + 11, len - 11, &t)) {
+      *out += t;
+      return XL_TEXT_DATETIME;
+    }
+    return XL_TEXT_STRING;
+  }
+
+  if (numparse_time(s, len, out))
+    return XL_TEXT_TIME;
+
+  return XL_TEXT_STRING;
+}
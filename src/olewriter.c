@@ -32,7 +32,12 @@ void ow_write_big_block_depot(struct owctx *ow);
 
 struct owctx * ow_new(const char *filename)
 {
-  return ow_new_ex(xl_file_handler,filename);
+  struct owctx *ow;
+
+  ow = ow_new_ex(xl_file_handler,filename);
+  if (ow != NULL)
+    ow_set_fileno(ow, xl_file_fileno);
+  return ow;
 }
 
 struct owctx * ow_new_ex(struct xl_io_handler io_handler, const char *filename)
@@ -62,6 +67,7 @@ int ow_init(struct owctx *ow, struct xl_io_handler io_handler, const char *filen
 
   ow->olefilename = filename;
   ow->io_handler = io_handler;
+  ow->io_fileno = NULL;
   ow->io_handle = NULL;
   ow->fileclosed = 0;
   ow->biff_only = 0;
@@ -227,11 +233,27 @@ void ow_close(struct owctx *ow)
  *
  * Write BIFF data to OLE file
  */
-void ow_write(struct owctx *ow, void *data, size_t len)
+void ow_write(struct owctx *ow, const void *data, size_t len)
 {
   ow->io_handler.write(ow->io_handle, data, len);
 }
 
+/* Set how to get a file descriptor for the handler's handle, NULL for
+ * none */
+void ow_set_fileno(struct owctx *ow, xl_io_fileno fn)
+{
+  ow->io_fileno = fn;
+}
+
+/* Returns a file descriptor that BIFF data can be written to directly,
+ * after anything already written has been flushed, or -1. */
+int ow_fileno(struct owctx *ow)
+{
+  if (ow->io_fileno == NULL || ow->io_handle == NULL)
+    return -1;
+  return ow->io_fileno(ow->io_handle);
+}
+
 /****************************************************************************
  * ow_write_big_block_depot(struct owctx *ow)
  *
@@ -310,7 +332,10 @@ void ow_write_pps(struct owctx *ow, char *name, int pps_type, int pps_dir, int p
   }
 
   pkt = pkt_init(0, VARIABLE_PACKET);
-  pkt_addraw(pkt, header, sizeof(header));
+  if (pkt_addraw(pkt, header, sizeof(header)) == -1) {
+    pkt_free(pkt);
+    return;
+  }
   pkt_add16_le(pkt, length); /* pps_sizeofname 0x40 */
   pkt_add16_le(pkt, pps_type); /* 0x42 */
   pkt_add32_le(pkt, -1); /* pps_prev  0x44 */
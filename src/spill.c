@@ -0,0 +1,662 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+/* 64 bit off_t for fseeko() and mmap() on 32 bit systems */
+#define _FILE_OFFSET_BITS 64
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <io.h>
+#include <windows.h>
+#define tmpfile() _xls_win32_tmpfile()
+#define spill_fseek(fp, off) _fseeki64((fp), (__int64)(off), SEEK_SET)
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define SPILL_MMAP 1
+#define spill_fseek(fp, off) fseeko((fp), (off_t)(off), SEEK_SET)
+#endif
+
+#include "lz.h"
+#include "spill.h"
+
+/* The mmap backend maps this much of the file at a time.  The file
+ * doubles in size as it fills, from SPILL_MINEXT up to steps of
+ * SPILL_EXTENT. */
+#define SPILL_WINDOW (4 * 1024 * 1024)
+#define SPILL_MINEXT (256 * 1024)
+#define SPILL_EXTENT (16 * 1024 * 1024)
+
+/* Compressed data is stored in blocks of up to XL_LZ_MAXBLOCK bytes, each
+ * after a header of its raw and stored sizes.  Blocks that do not shrink
+ * are stored as they are, flagged with SPILL_LZRAW. */
+#define SPILL_LZHDR 8
+#define SPILL_LZRAW 0x80000000U
+
+/* Extent list entries allocated for a stream to begin with */
+#define SPILL_MINEXTS 4
+
+#ifdef WIN32
+FILE *_xls_win32_tmpfile(void)
+{
+  char path_name[MAX_PATH + 1];
+  char file_name[MAX_PATH + 1];
+  DWORD path_len;
+  HANDLE handle;
+  int fd;
+  FILE *fp;
+
+
+  path_len = GetTempPath(MAX_PATH, path_name);
+  if (path_len <= 0 || path_len >= MAX_PATH)
+    return NULL;
+
+  if (GetTempFileName(path_name, "xl_", 0, file_name) == 0)
+    return NULL;
+
+  handle = CreateFile(file_name, GENERIC_READ | GENERIC_WRITE,
+      0, NULL, CREATE_ALWAYS,
+      FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE,
+      NULL);
+
+  if (handle == INVALID_HANDLE_VALUE) {
+    DeleteFile(file_name);
+    return NULL;
+  }
+
+  fd = _open_osfhandle((intptr_t)handle, 0);
+  if (fd < 0) {
+    CloseHandle(handle);
+    return NULL;
+  }
+
+  fp = fdopen(fd, "w+b");
+  if (fp == NULL) {
+    _close(fd);
+    return NULL;
+  }
+
+  return fp;
+}
+#endif
+
+#ifdef SPILL_MMAP
+/* Open an anonymous file in dir, or if that is NULL in $TMPDIR or /tmp.
+ * Where O_TMPFILE is supported the file never has a name at all. */
+static int spill_open(const char *dir)
+{
+  char *path;
+  size_t len;
+  int fd;
+
+  if (dir == NULL)
+    dir = getenv("TMPDIR");
+  if (dir == NULL || *dir == '\0')
+    dir = "/tmp";
+
+#ifdef O_TMPFILE
+  fd = open(dir, O_TMPFILE | O_RDWR | O_EXCL, 0600);
+  if (fd != -1)
+    return fd;
+#endif
+
+  len = strlen(dir) + sizeof("/xl_XXXXXX");
+  path = malloc(len);
+  if (path == NULL)
+    return -1;
+  snprintf(path, len, "%s/xl_XXXXXX", dir);
+
+  fd = mkstemp(path);
+  if (fd != -1)
+    unlink(path);
+  free(path);
+  return fd;
+}
+
+/* Make the file bigger.  Disk blocks are allocated up front where
+ * possible, so that stores into the mapping do not allocate them a page
+ * at a time. */
+static int spill_grow(struct xl_spillfile *f)
+{
+  size_t len = f->filesize;
+
+  if (len < SPILL_MINEXT)
+    len = SPILL_MINEXT;
+  if (len > SPILL_EXTENT)
+    len = SPILL_EXTENT;
+
+#ifdef __linux__
+  if (fallocate(f->fd, 0, f->filesize, len) == -1 &&
+      ftruncate(f->fd, f->filesize + len) == -1)
+    return -1;
+#else
+  if (ftruncate(f->fd, f->filesize + len) == -1)
+    return -1;
+#endif
+  f->filesize += len;
+  return 0;
+}
+
+/* Unmap the current window.  Its pages are not needed again soon, so let
+ * the kernel reclaim them first. */
+static void spill_unmap(struct xl_spillfile *f)
+{
+  if (f->win == NULL)
+    return;
+
+#ifdef MADV_COLD
+  madvise(f->win, f->win_len, MADV_COLD);
+#endif
+  munmap(f->win, f->win_len);
+  f->win = NULL;
+}
+
+/* Map the window that holds file offset pos, unless it already is.  Only
+ * the part of it that lies within the file may be touched. */
+static int spill_map(struct xl_spillfile *f, size_t pos)
+{
+  size_t off = pos - pos % SPILL_WINDOW;
+  void *win;
+
+  if (f->win != NULL && f->win_off == off)
+    return 0;
+  spill_unmap(f);
+
+  win = mmap(NULL, SPILL_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED,
+      f->fd, off);
+  if (win == MAP_FAILED)
+    return -1;
+  madvise(win, SPILL_WINDOW, MADV_SEQUENTIAL);
+
+  f->win = win;
+  f->win_off = off;
+  f->win_len = SPILL_WINDOW;
+  return 0;
+}
+
+/* Give back the disk space and cache behind data already read */
+static void spill_release(struct xl_spillfile *f, size_t off, size_t len)
+{
+#ifdef FALLOC_FL_PUNCH_HOLE
+  fallocate(f->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len);
+#else
+  (void)f;
+  (void)off;
+  (void)len;
+#endif
+}
+#endif /* SPILL_MMAP */
+
+/* Set up an unopened spill file with the default backend */
+void spill_file_init(struct xl_spillfile *f)
+{
+  f->backend = XL_SPILL_STDIO;
+  f->compress = 0;
+  f->dir = NULL;
+  f->zbuf = NULL;
+  f->fp = NULL;
+  f->fd = -1;
+  f->size = 0;
+  f->filesize = 0;
+  f->fpos = 0;
+  f->reading = 0;
+  f->win = NULL;
+  f->win_off = 0;
+  f->win_len = 0;
+  f->lock = NULL;
+}
+
+/* Let several threads write to streams of the file at the same time.
+ * Returns -1 if that is not possible. */
+int spill_file_shared(struct xl_spillfile *f)
+{
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t *lock;
+
+  if (f->lock != NULL)
+    return 0;
+
+  lock = malloc(sizeof(pthread_mutex_t));
+  if (lock == NULL)
+    return -1;
+  if (pthread_mutex_init(lock, NULL) != 0) {
+    free(lock);
+    return -1;
+  }
+  f->lock = lock;
+  return 0;
+#else
+  (void)f;
+  return -1;
+#endif
+}
+
+static void spill_lock(struct xl_spillfile *f)
+{
+#ifdef HAVE_PTHREAD
+  if (f->lock != NULL)
+    pthread_mutex_lock(f->lock);
+#else
+  (void)f;
+#endif
+}
+
+static void spill_unlock(struct xl_spillfile *f)
+{
+#ifdef HAVE_PTHREAD
+  if (f->lock != NULL)
+    pthread_mutex_unlock(f->lock);
+#else
+  (void)f;
+#endif
+}
+
+/* Choose the backend, possibly or'ed with XL_SPILL_LZ, and the directory
+ * (NULL for the default) of the file.  Returns -1 once it is open. */
+int spill_file_setup(struct xl_spillfile *f, int backend, const char *dir)
+{
+  if (f->fp != NULL || f->fd != -1)
+    return -1;
+
+  f->backend = backend & ~XL_SPILL_LZ;
+  f->compress = (backend & XL_SPILL_LZ) != 0;
+  f->dir = dir;
+  return 0;
+}
+
+/* Create the file.  The mmap backend falls back to stdio where it is not
+ * available. */
+static int spill_file_open(struct xl_spillfile *f)
+{
+  if (f->compress && f->zbuf == NULL) {
+    f->zbuf = malloc(SPILL_LZHDR + XL_LZ_BOUND(XL_LZ_MAXBLOCK));
+    if (f->zbuf == NULL)
+      return -1;
+  }
+
+#ifdef SPILL_MMAP
+  if (f->backend == XL_SPILL_MMAP) {
+    f->fd = spill_open(f->dir);
+    if (f->fd != -1)
+      return 0;
+  } else if (f->dir != NULL) {
+    int fd = spill_open(f->dir);
+
+    if (fd != -1) {
+      f->fp = fdopen(fd, "w+b");
+      if (f->fp == NULL)
+        close(fd);
+    }
+  }
+#endif
+
+  f->backend = XL_SPILL_STDIO;
+  if (f->fp == NULL)
+    f->fp = tmpfile();
+  return f->fp != NULL ? 0 : -1;
+}
+
+/* Close the file and free what goes with it */
+void spill_file_close(struct xl_spillfile *f)
+{
+#ifdef SPILL_MMAP
+  spill_unmap(f);
+  if (f->fd != -1)
+    close(f->fd);
+#endif
+  if (f->fp)
+    fclose(f->fp);
+  free(f->zbuf);
+#ifdef HAVE_PTHREAD
+  if (f->lock != NULL) {
+    pthread_mutex_destroy(f->lock);
+    free(f->lock);
+  }
+#endif
+  spill_file_init(f);
+}
+
+/* Start a new stream of data in f, opening f if this is the first one */
+struct xl_spill *spill_new(struct xl_spillfile *f)
+{
+  struct xl_spill *sp;
+  int ret = 0;
+
+  spill_lock(f);
+  if (f->fp == NULL && f->fd == -1)
+    ret = spill_file_open(f);
+  spill_unlock(f);
+  if (ret == -1)
+    return NULL;
+
+  sp = malloc(sizeof(struct xl_spill));
+  if (sp == NULL)
+    return NULL;
+
+  sp->file = f;
+  sp->ext = NULL;
+  sp->nexts = 0;
+  sp->extcap = 0;
+  sp->size = 0;
+  sp->cur = 0;
+  sp->pos = 0;
+  return sp;
+}
+
+/* Forget a stream.  Its data stays in the file until that is closed. */
+void spill_destroy(struct xl_spill *sp)
+{
+  if (sp == NULL)
+    return;
+
+  free(sp->ext);
+  free(sp);
+}
+
+/* Append len bytes to the file as they are, at the end of the stream's
+ * last extent if nothing else was written since */
+static int spill_put(struct xl_spill *sp, const void *data, size_t len)
+{
+  struct xl_spillfile *f = sp->file;
+  struct xl_extent *ext;
+  size_t start = f->size;
+
+  if (len == 0)
+    return 0;
+
+  ext = sp->nexts > 0 ? &sp->ext[sp->nexts - 1] : NULL;
+  if (ext == NULL || ext->off + ext->len != start) {
+    if (sp->nexts == sp->extcap) {
+      int cap = sp->extcap ? sp->extcap * 2 : SPILL_MINEXTS;
+
+      ext = realloc(sp->ext, cap * sizeof(struct xl_extent));
+      if (ext == NULL)
+        return -1;
+      sp->ext = ext;
+      sp->extcap = cap;
+    }
+    ext = &sp->ext[sp->nexts++];
+    ext->off = start;
+    ext->len = 0;
+  }
+
+#ifdef SPILL_MMAP
+  if (f->backend == XL_SPILL_MMAP) {
+    const unsigned char *p = data;
+    size_t n, left = len;
+
+    while (left > 0) {
+      if (f->size == f->filesize && spill_grow(f) == -1)
+        return -1;
+      if (spill_map(f, f->size) == -1)
+        return -1;
+
+      n = f->win_off + f->win_len;
+      if (n > f->filesize)
+        n = f->filesize;
+      n -= f->size;
+      if (n > left)
+        n = left;
+      memcpy(f->win + (f->size - f->win_off), p, n);
+      f->size += n;
+      ext->len += n;
+      p += n;
+      left -= n;
+    }
+    sp->size += len;
+    return 0;
+  }
+#endif
+
+  /* A stdio stream must be repositioned between reads and writes */
+  if (f->reading || f->fpos != f->size) {
+    if (spill_fseek(f->fp, f->size) != 0)
+      return -1;
+    f->reading = 0;
+  }
+  if (fwrite(data, len, 1, f->fp) != 1)
+    return -1;
+  f->size += len;
+  f->fpos = f->size;
+  ext->len += len;
+  sp->size += len;
+  return 0;
+}
+
+/* Append len bytes, compressing them if asked to */
+static int spill_store(struct xl_spill *sp, const void *data, size_t len)
+{
+  unsigned char *zbuf = sp->file->zbuf;
+  const unsigned char *p = data;
+  uint32_t stored;
+  size_t n;
+
+  if (!sp->file->compress)
+    return spill_put(sp, data, len);
+
+  while (len > 0) {
+    n = len < XL_LZ_MAXBLOCK ? len : XL_LZ_MAXBLOCK;
+
+    stored = (uint32_t)xl_lz_compress(p, n, zbuf + SPILL_LZHDR,
+        XL_LZ_BOUND(XL_LZ_MAXBLOCK));
+    if (stored == 0 || stored >= n) {
+      memcpy(zbuf + SPILL_LZHDR, p, n);
+      stored = (uint32_t)n | SPILL_LZRAW;
+    }
+
+    zbuf[0] = (unsigned char)n;
+    zbuf[1] = (unsigned char)(n >> 8);
+    zbuf[2] = (unsigned char)(n >> 16);
+    zbuf[3] = (unsigned char)(n >> 24);
+    zbuf[4] = (unsigned char)stored;
+    zbuf[5] = (unsigned char)(stored >> 8);
+    zbuf[6] = (unsigned char)(stored >> 16);
+    zbuf[7] = (unsigned char)(stored >> 24);
+    if (spill_put(sp, zbuf, SPILL_LZHDR + (stored & ~SPILL_LZRAW)) == -1)
+      return -1;
+
+    p += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+/* Append len bytes.  Returns -1 on error. */
+int spill_write(struct xl_spill *sp, const void *data, size_t len)
+{
+  int ret;
+
+  spill_lock(sp->file);
+  ret = spill_store(sp, data, len);
+  spill_unlock(sp->file);
+  return ret;
+}
+
+/* Called once everything has been written to the stream, to read it back
+ * from the start. */
+int spill_finish(struct xl_spill *sp)
+{
+  int ret = 0;
+
+  sp->cur = 0;
+  sp->pos = 0;
+
+  spill_lock(sp->file);
+  if (sp->file->fp != NULL && fflush(sp->file->fp) != 0)
+    ret = -1;
+  spill_unlock(sp->file);
+  return ret;
+}
+
+/* Move on from extents that have been read completely, letting go of
+ * the space they take in a mapped file.  This waits until the read after
+ * the one that finished the extent, when nothing points into it any
+ * more. */
+static void spill_next(struct xl_spill *sp)
+{
+  while (sp->cur < sp->nexts && sp->pos == sp->ext[sp->cur].len) {
+#ifdef SPILL_MMAP
+    if (sp->file->backend == XL_SPILL_MMAP)
+      spill_release(sp->file, sp->ext[sp->cur].off, sp->ext[sp->cur].len);
+#endif
+    sp->cur++;
+    sp->pos = 0;
+  }
+}
+
+/* Returns up to max bytes from the read position, in buf for the stdio
+ * backend or in the mapped window otherwise, or NULL at the end */
+static const unsigned char *spill_raw(struct xl_spill *sp, unsigned char *buf, size_t max, size_t *len)
+{
+  struct xl_spillfile *f = sp->file;
+  size_t off, n;
+
+  spill_next(sp);
+  *len = 0;
+  if (sp->cur >= sp->nexts)
+    return NULL;
+
+  off = sp->ext[sp->cur].off + sp->pos;
+  n = sp->ext[sp->cur].len - sp->pos;
+  if (n > max)
+    n = max;
+
+#ifdef SPILL_MMAP
+  if (f->backend == XL_SPILL_MMAP) {
+    if (spill_map(f, off) == -1)
+      return NULL;
+    if (n > f->win_off + f->win_len - off)
+      n = f->win_off + f->win_len - off;
+    sp->pos += n;
+    *len = n;
+    return f->win + (off - f->win_off);
+  }
+#endif
+
+  if (!f->reading || f->fpos != off) {
+    if (spill_fseek(f->fp, off) != 0)
+      return NULL;
+    f->reading = 1;
+  }
+  n = fread(buf, 1, n, f->fp);
+  f->fpos = off + n;
+  sp->pos += n;
+  *len = n;
+  return n > 0 ? buf : NULL;
+}
+
+/* Copy exactly len bytes from the read position into dst */
+static int spill_get(struct xl_spill *sp, unsigned char *dst, size_t len)
+{
+  const unsigned char *p;
+  size_t n;
+
+  while (len > 0) {
+    p = spill_raw(sp, dst, len, &n);
+    if (p == NULL)
+      return -1;
+    if (p != dst)
+      memcpy(dst, p, n);
+    dst += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* Read back one compressed block into buf */
+static const unsigned char *spill_unpack(struct xl_spill *sp, unsigned char *buf, size_t cap, size_t *len)
+{
+  unsigned char *zbuf = sp->file->zbuf;
+  unsigned char hdr[SPILL_LZHDR];
+  uint32_t rawlen, stored;
+
+  *len = 0;
+  if (spill_get(sp, hdr, sizeof(hdr)) == -1)
+    return NULL;
+
+  rawlen = hdr[0] | (hdr[1] << 8) | ((uint32_t)hdr[2] << 16) | ((uint32_t)hdr[3] << 24);
+  stored = hdr[4] | (hdr[5] << 8) | ((uint32_t)hdr[6] << 16) | ((uint32_t)hdr[7] << 24);
+  if (rawlen > cap || rawlen > XL_LZ_MAXBLOCK)
+    return NULL;
+
+  if (stored & SPILL_LZRAW) {
+    if (spill_get(sp, buf, rawlen) == -1)
+      return NULL;
+  } else {
+    if (stored > XL_LZ_BOUND(XL_LZ_MAXBLOCK) || spill_get(sp, zbuf, stored) == -1)
+      return NULL;
+    if (xl_lz_decompress(zbuf, stored, buf, cap) != rawlen)
+      return NULL;
+  }
+
+  *len = rawlen;
+  return buf;
+}
+
+/* Returns the next piece of data and its length in len, or NULL at the
+ * end.  The stdio backend and compressed data are read into buf, which
+ * has room for cap bytes (at least XL_LZ_MAXBLOCK when compressed); the
+ * mmap backend returns a pointer into its window instead.  The data is
+ * valid until the next call. */
+const unsigned char *spill_read(struct xl_spill *sp, unsigned char *buf, size_t cap, size_t *len)
+{
+  if (sp->file->compress)
+    return spill_unpack(sp, buf, cap, len);
+  if (sp->file->backend == XL_SPILL_MMAP)
+    cap = (size_t)-1;
+  return spill_raw(sp, buf, cap, len);
+}
+
+/* Returns a file descriptor holding the data, for copying it elsewhere
+ * without reading it, see spill_extent() */
+int spill_fd(struct xl_spill *sp)
+{
+  if (sp->file->backend == XL_SPILL_MMAP)
+    return sp->file->fd;
+  return fileno(sp->file->fp);
+}
+
+/* Gives the offset in spill_fd() and the length of the next data to be
+ * read.  Returns -1 once everything has been read. */
+int spill_extent(struct xl_spill *sp, size_t *off, size_t *len)
+{
+  spill_next(sp);
+  if (sp->cur >= sp->nexts)
+    return -1;
+
+  *off = sp->ext[sp->cur].off + sp->pos;
+  *len = sp->ext[sp->cur].len - sp->pos;
+  return 0;
+}
+
+/* Move the read position on by len, after that much has been taken from
+ * spill_fd() at the place spill_extent() gave */
+void spill_skip(struct xl_spill *sp, size_t len)
+{
+  sp->pos += len;
+}
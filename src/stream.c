@@ -52,8 +52,8 @@ pkt_init(size_t len, int type)
 	p = malloc((size_t) sizeof(struct pkt));
 	if (p == NULL) return NULL;
 
-	if (type == VARIABLE_PACKET) p->data = malloc(MAX_SIZE);
-	else p->data = malloc(len);
+	if (type == VARIABLE_PACKET) len = MAX_SIZE;
+	p->data = malloc(len);
 
 	if (p->data == NULL) {
 		free(p);
@@ -62,69 +62,161 @@ pkt_init(size_t len, int type)
 
 	p->len = 0;
 	p->offset = 0;
+	p->size = len;
+	p->type = type;
 
 	return p;
 
 }
 
-void pkt_addraw(struct pkt *p, const unsigned char *bytes, size_t len)
+/* Build a packet on top of caller supplied storage (usually a small buffer
+ * on the stack) so that short fixed-size records can be put together
+ * without touching the heap.  Never call pkt_free() on such a packet. */
+void
+pkt_attach(struct pkt *p, unsigned char *buf, size_t size)
 {
-	memcpy(p->data + p->offset, bytes, len);
-	p->offset += len;
-	p->len += len;
+	p->data = buf;
+	p->len = 0;
+	p->offset = 0;
+	p->size = size;
+	p->type = FIXED_PACKET;
 }
 
-void pkt_addzero(struct pkt *p, int num_zeros)
+/* Slow path of pkt_reserve().  Variable packets double in size until len
+ * more bytes fit; anything else has run out of room and gets NULL. */
+unsigned char *
+pkt_grow(struct pkt *p, size_t len)
 {
-	memset(p->data + p->offset, 0, num_zeros);
-	p->offset += num_zeros;
-	p->len += num_zeros;
+	unsigned char *data;
+	size_t size = p->size;
+
+	if (p->type != VARIABLE_PACKET)
+		return NULL;
+
+	while (size - p->offset < len)
+		size *= 2;
+
+	data = realloc(p->data, size);
+	if (data == NULL)
+		return NULL;
+
+	p->data = data;
+	p->size = size;
+	return p->data + p->offset;
+}
+
+/* The pkt_add*() functions return -1, leaving the packet as it was, when
+ * a fixed size packet has no room left or a variable one cannot grow */
+int pkt_addraw(struct pkt *p, const unsigned char *bytes, size_t len)
+{
+	unsigned char *d;
+
+	if ((d = pkt_reserve(p, len)) == NULL) return -1;
+	xl_putraw(d, bytes, len);
+	pkt_commit(p, len);
+	return 0;
 }
 
-void pkt_addstring(struct pkt *p, const char *bytes) {
+int pkt_addzero(struct pkt *p, int num_zeros)
+{
+	unsigned char *d;
+
+	if ((d = pkt_reserve(p, num_zeros)) == NULL) return -1;
+	memset(d, 0, num_zeros);
+	pkt_commit(p, num_zeros);
+	return 0;
+}
+
+int pkt_addstring(struct pkt *p, const char *bytes) {
 	uint32_t len;
 
 	len = strlen(bytes);
-	pkt_addraw(p, (unsigned char *) bytes, len);
+	return pkt_addraw(p, (unsigned char *) bytes, len);
+}
+
+int pkt_add8(struct pkt *p, uint8_t val)
+{
+	unsigned char *d;
+
+	if ((d = pkt_reserve(p, 1)) == NULL) return -1;
+	xl_put8(d, val);
+	pkt_commit(p, 1);
+	return 0;
 }
 
-void pkt_add8(struct pkt *p, uint8_t val)
+int pkt_add16_le(struct pkt *p, uint16_t val)
 {
-	p->data[p->offset] = val;
-	p->offset++;
-	p->len++;
+	unsigned char *d;
+
+	if ((d = pkt_reserve(p, 2)) == NULL) return -1;
+	xl_put16_le(d, val);
+	pkt_commit(p, 2);
+	return 0;
 }
 
-void pkt_add16_le(struct pkt *p, uint16_t val)
+int pkt_add16(struct pkt *p, uint16_t val)
 {
-	p->data[p->offset++] = (val & 0xff);
-	p->data[p->offset++] = (val & 0xff00) >> 8;
-	p->len += 2;
+	unsigned char *d;
+
+	if ((d = pkt_reserve(p, 2)) == NULL) return -1;
+	d[0] = (val & 0xff00) >> 8;
+	d[1] = (val & 0xff);
+	pkt_commit(p, 2);
+	return 0;
 }
 
-void pkt_add16(struct pkt *p, uint16_t val)
+int pkt_add32_le(struct pkt *p, uint32_t val)
 {
-	p->data[p->offset++] = (val & 0xff00) >> 8;
-	p->data[p->offset++] = (val & 0xff);
-	p->len += 2;
+	unsigned char *d;
+
+	if ((d = pkt_reserve(p, 4)) == NULL) return -1;
+	xl_put32_le(d, val);
+	pkt_commit(p, 4);
+	return 0;
 }
 
-void pkt_add32_le(struct pkt *p, uint32_t val)
+int pkt_add32(struct pkt *p, uint32_t val)
 {
-	p->data[p->offset++] = (val & 0xff);
-	p->data[p->offset++] = (val & 0xff00) >> 8;
-	p->data[p->offset++] = (val & 0xff0000) >> 16;
-	p->data[p->offset++] = (val & 0xff000000) >> 24;
-	p->len += 4;
+	unsigned char *d;
+
+	if ((d = pkt_reserve(p, 4)) == NULL) return -1;
+	d[0] = (val & 0xff000000) >> 24;
+	d[1] = (val & 0xff0000) >> 16;
+	d[2] = (val & 0xff00) >> 8;
+	d[3] = (val & 0xff);
+	pkt_commit(p, 4);
+	return 0;
 }
 
-void pkt_add32(struct pkt *p, uint32_t val)
+/* Store an array of doubles in BIFF byte order.  Little endian hosts copy
+ * the array as is; big endian hosts swap it in a single loop that the
+ * compiler can vectorise. */
+void xl_putdoubles(unsigned char *d, const double *vals, size_t n)
 {
-	p->data[p->offset++] = (val & 0xff000000) >> 24;
-	p->data[p->offset++] = (val & 0xff0000) >> 16;
-	p->data[p->offset++] = (val & 0xff00) >> 8;
-	p->data[p->offset++] = (val & 0xff);
-	p->len += 4;
+#ifdef XL_BIG_ENDIAN
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		uint64_t bits;
+
+		memcpy(&bits, &vals[i], sizeof(bits));
+#if defined(__GNUC__)
+		bits = __builtin_bswap64(bits);
+#else
+		bits = ((bits & 0x00000000000000FFULL) << 56) |
+		    ((bits & 0x000000000000FF00ULL) << 40) |
+		    ((bits & 0x0000000000FF0000ULL) << 24) |
+		    ((bits & 0x00000000FF000000ULL) << 8) |
+		    ((bits & 0x000000FF00000000ULL) >> 8) |
+		    ((bits & 0x0000FF0000000000ULL) >> 24) |
+		    ((bits & 0x00FF000000000000ULL) >> 40) |
+		    ((bits & 0xFF00000000000000ULL) >> 56);
+#endif
+		memcpy(d + i * sizeof(bits), &bits, sizeof(bits));
+	}
+#else
+	memcpy(d, vals, n * sizeof(double));
+#endif
 }
 
 void pkt_free(struct pkt * p)
@@ -136,4 +228,3 @@ void pkt_free(struct pkt * p)
 	}
 	free(p);
 }
-
@@ -16,6 +16,9 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,6 +27,22 @@
 #include "stream.h"
 #include "hashhelp.h"
 
+/* Entries allocated for sheets and formats to begin with */
+#define WBOOK_MINCAP 16
+
+/* Worksheets being closed by wbook_store_workbook(), possibly by several
+ * threads at once, see wbook_set_threads() */
+struct wbook_pool {
+  struct wbookctx *wbook;
+  int next;      /* Next sheet to close */
+  int threaded;  /* lock and threads are set up */
+  int nthreads;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t lock;
+  pthread_t *threads;
+#endif
+};
+
 void wbook_store_window1(struct wbookctx *wbook);
 void wbook_store_all_fonts(struct wbookctx *wbook);
 void wbook_store_all_xfs(struct wbookctx *wbook);
@@ -34,10 +53,16 @@ static void wbook_store_1904(struct wbookctx *wbook);
 static void wbook_store_num_format(struct wbookctx *wbook, char *format, int index);
 static void wbook_store_codepage(struct wbookctx *wbook);
 void wbook_store_all_num_formats(struct wbookctx *wbook);
+static struct xl_format *wbook_add_default(void *ctx, int which);
 
 struct wbookctx *wbook_new(const char *filename, int store_in_memory)
 {
-	return wbook_new_ex(xl_file_handler, filename, store_in_memory);
+	struct wbookctx *wbook;
+
+	wbook = wbook_new_ex(xl_file_handler, filename, store_in_memory);
+	if (wbook != NULL)
+		wbook_set_io_fileno(wbook, xl_file_fileno);
+	return wbook;
 }
 
 struct wbookctx *wbook_new_ex(struct xl_io_handler io_handler, const char *filename, int store_in_memory)
@@ -52,6 +77,13 @@ struct wbookctx *wbook_new_ex(struct xl_io_handler io_handler, const char *filen
     return NULL;
   }
   wbook->store_in_memory = store_in_memory;
+  wbook->threads = 1;
+  wbook->spill_backend = XL_SPILL_STDIO;
+  wbook->tmpdir = NULL;
+  spill_file_init(&wbook->spill);
+  wbook->budget.limit = 0;
+  wbook->budget.used = 0;
+  TAILQ_INIT(&wbook->budget.sheets);
   wbook->epoch1904 = 0;
   wbook->activesheet = 0;
   wbook->firstsheet = 0;
@@ -61,11 +93,16 @@ struct wbookctx *wbook_new_ex(struct xl_io_handler io_handler, const char *filen
   wbook->sheetname = "Sheet";
   wbook->tmp_format = fmt_new(0);
   wbook->url_format = NULL;
+  memset(&wbook->defaults, 0, sizeof(wbook->defaults));
+  wbook->defaults.add = wbook_add_default;
+  wbook->defaults.ctx = wbook;
   wbook->codepage = 0x04E4; /* 1252 */
   wbook->sheets = NULL;
   wbook->sheetcount = 0;
+  wbook->sheetcap = 0;
   wbook->formats = NULL;
   wbook->formatcount = 0;
+  wbook->formatcap = 0;
 
   /* Add the default format for hyperlinks */
   wbook->url_format = wbook_addformat(wbook);
@@ -107,45 +144,58 @@ void wbook_destroy(struct wbookctx *wbook)
   ow_destroy(wbook->OLEwriter);
   bw_destroy(wbook->biff);
 
+  spill_file_close(&wbook->spill);
   free(wbook->sheets);
   free(wbook->formats);
+  free(wbook->tmpdir);
   free(wbook);
 }
 
-struct wsheetctx * wbook_addworksheet(struct wbookctx *wbook, char *sname)
+struct wsheetctx * wbook_addworksheet(struct wbookctx *wbook, const char *sname)
 {
-  char *name = sname;
+  if (sname == NULL)
+    return wbook_addworksheet_n(wbook, NULL, 0);
+  return wbook_addworksheet_n(wbook, sname, strlen(sname));
+}
+
+/* As wbook_addworksheet() but takes the length of sname, which need not
+ * be NUL terminated.  Sheet names are limited to 31 characters. */
+struct wsheetctx * wbook_addworksheet_n(struct wbookctx *wbook, const char *sname, size_t len)
+{
+  char name[32];
   int index;
-  int malloc_flag = 0;
   struct wsheetctx *wsheet;
 
-  if (name && strlen(name) > 31)
-    name[31] = '\0';
-
   index = wbook->sheetcount;
-  if (sname == NULL)
-  {
-    int len = strlen(wbook->sheetname) + 20;
-
-    name = malloc(len);
-    snprintf(name, len, "%s%d", wbook->sheetname, index + 1);
-	malloc_flag = 1;
+  if (sname == NULL) {
+    snprintf(name, sizeof(name), "%s%d", wbook->sheetname, index + 1);
+  } else {
+    if (len > 31) len = 31;
+    memcpy(name, sname, len);
+    name[len] = '\0';
   }
 
-  if (wbook->sheets == NULL)
-    wbook->sheets = malloc(sizeof(struct wsheetctx *));
-  else
-    wbook->sheets = realloc(wbook->sheets, sizeof(struct wsheetctx *) * (index + 1));
+  /* Grow geometrically so that adding many sheets stays linear */
+  if (index == wbook->sheetcap) {
+    int cap = wbook->sheetcap ? wbook->sheetcap * 2 : WBOOK_MINCAP;
+    struct wsheetctx **sheets;
+
+    sheets = realloc(wbook->sheets, sizeof(struct wsheetctx *) * cap);
+    if (sheets == NULL)
+      return NULL;
+    wbook->sheets = sheets;
+    wbook->sheetcap = cap;
+  }
 
   wsheet = wsheet_new(name, index, wbook->activesheet, wbook->firstsheet,
       wbook->url_format, wbook->store_in_memory);
+  wsheet->defaults = &wbook->defaults;
+  wsheet->spillfile = &wbook->spill;
+  if (wbook->budget.limit > 0)
+    wsheet_set_budget(wsheet, &wbook->budget);
   wbook->sheets[index] = wsheet;
   wbook->sheetcount++;
 
-  if (malloc_flag == 1) {
-	free(name);
-  }
-
   return wsheet;
 }
 
@@ -158,10 +208,16 @@ struct xl_format *wbook_addformat(struct wbookctx *wbook)
 
   index = wbook->formatcount;
 
-  if (wbook->formats == NULL)
-    wbook->formats = malloc(sizeof(struct xl_format *));
-  else
-    wbook->formats = realloc(wbook->formats, sizeof(struct xl_format *) * (index + 1));
+  if (index == wbook->formatcap) {
+    int cap = wbook->formatcap ? wbook->formatcap * 2 : WBOOK_MINCAP;
+    struct xl_format **formats;
+
+    formats = realloc(wbook->formats, sizeof(struct xl_format *) * cap);
+    if (formats == NULL)
+      return NULL;
+    wbook->formats = formats;
+    wbook->formatcap = cap;
+  }
 
   fmt = fmt_new(wbook->xf_index);
   wbook->xf_index += 1;
@@ -172,6 +228,68 @@ struct xl_format *wbook_addformat(struct wbookctx *wbook)
   return fmt;
 }
 
+/* Add one of the built in formats of xl_defaults when a sheet first asks
+ * for it.  They use the built in number formats m/d/yy, m/d/yy h:mm,
+ * h:mm:ss and 0.00%. */
+static struct xl_format *wbook_add_default(void *ctx, int which)
+{
+  static const int num_formats[XLS_FMT_COUNT] = { 0x0E, 0x16, 0x15, 0x0A };
+  struct xl_format *fmt;
+
+  fmt = wbook_addformat((struct wbookctx *)ctx);
+  if (fmt != NULL)
+    fmt_set_num_format(fmt, num_formats[which]);
+
+  return fmt;
+}
+
+/* Choose how worksheets that are not stored in memory keep their records:
+ * XL_SPILL_STDIO (the default) or XL_SPILL_MMAP, either of them or'ed with
+ * XL_SPILL_LZ to compress what is written.  All the sheets share one
+ * temporary file, so this only has an effect until the first of them
+ * spills. */
+void wbook_set_spill(struct wbookctx *wbook, int backend)
+{
+  wbook->spill_backend = backend;
+  spill_file_setup(&wbook->spill, backend, wbook->tmpdir);
+}
+
+/* Create the temporary file in dir rather than the system default.  On
+ * Linux it is opened with O_TMPFILE where the filesystem allows.  Like
+ * wbook_set_spill() this must come before any sheet spills. */
+void wbook_set_tmpdir(struct wbookctx *wbook, const char *dir)
+{
+  free(wbook->tmpdir);
+  wbook->tmpdir = dir ? strdup(dir) : NULL;
+  spill_file_setup(&wbook->spill, wbook->spill_backend, wbook->tmpdir);
+}
+
+/* Let spilled worksheets be copied to the output by the kernel: fn
+ * returns the file descriptor behind the handle given to wbook_new_ex().
+ * wbook_new() sets this up for its own files. */
+void wbook_set_io_fileno(struct wbookctx *wbook, xl_io_fileno fn)
+{
+  ow_set_fileno(wbook->OLEwriter, fn);
+}
+
+/* Keep worksheets in memory until, between them, they hold more than
+ * bytes; then move the biggest ones to temporary files until they fit
+ * again.  This overrides store_in_memory for sheets added afterwards.
+ * 0 turns the budget off. */
+void wbook_set_memory_budget(struct wbookctx *wbook, size_t bytes)
+{
+  wbook->budget.limit = bytes;
+}
+
+/* Close worksheets on up to n threads, counting the one that calls
+ * wbook_close(), which builds the workbook globals in the meantime.  The
+ * threads only live while the workbook is being closed.  Without thread
+ * support the sheets are closed one after the other whatever n is. */
+void wbook_set_threads(struct wbookctx *wbook, int n)
+{
+  wbook->threads = n > 1 ? n : 1;
+}
+
 /****************************************************************************
  *
  * _calc_sheet_offsets()
@@ -197,6 +315,98 @@ void wbook_calc_sheet_offsets(struct wbookctx *wbook)
   wbook->biffsize = offset;
 }
 
+/* Close sheets until there are none left */
+static void wbook_pool_work(struct wbook_pool *pool)
+{
+  int i;
+
+  for (;;) {
+#ifdef HAVE_PTHREAD
+    if (pool->threaded)
+      pthread_mutex_lock(&pool->lock);
+#endif
+    i = pool->next++;
+#ifdef HAVE_PTHREAD
+    if (pool->threaded)
+      pthread_mutex_unlock(&pool->lock);
+#endif
+    if (i >= pool->wbook->sheetcount)
+      break;
+    wsheet_close(pool->wbook->sheets[i]);
+  }
+}
+
+#ifdef HAVE_PTHREAD
+static void *wbook_pool_run(void *arg)
+{
+  wbook_pool_work(arg);
+  return NULL;
+}
+#endif
+
+/* Start closing the worksheets.  Given threads, they carry on in the
+ * background until wbook_pool_finish(); otherwise every sheet is closed
+ * before this returns. */
+static void wbook_pool_start(struct wbookctx *wbook, struct wbook_pool *pool)
+{
+#ifdef HAVE_PTHREAD
+  int i, n;
+#endif
+
+  pool->wbook = wbook;
+  pool->next = 0;
+  pool->threaded = 0;
+  pool->nthreads = 0;
+
+#ifdef HAVE_PTHREAD
+  n = wbook->threads - 1;
+  if (n > wbook->sheetcount)
+    n = wbook->sheetcount;
+
+  if (n > 0 && spill_file_shared(&wbook->spill) == 0 &&
+      pthread_mutex_init(&pool->lock, NULL) == 0) {
+    pool->threads = malloc(sizeof(pthread_t) * n);
+    if (pool->threads != NULL) {
+      /* Under a budget one sheet may move another to the temporary file,
+       * which cannot be allowed while both are being closed.  Sheets
+       * still in memory stay there; closing adds little to them. */
+      for (i = 0; i < wbook->sheetcount; i++)
+        wsheet_unbudget(wbook->sheets[i]);
+
+      pool->threaded = 1;
+      for (i = 0; i < n; i++) {
+        if (pthread_create(&pool->threads[i], NULL, wbook_pool_run, pool) != 0)
+          break;
+        pool->nthreads++;
+      }
+      return;
+    }
+    pthread_mutex_destroy(&pool->lock);
+  }
+#endif
+
+  wbook_pool_work(pool);
+}
+
+/* Help close the sheets that are left and wait for the threads */
+static void wbook_pool_finish(struct wbook_pool *pool)
+{
+#ifdef HAVE_PTHREAD
+  int i;
+
+  if (!pool->threaded)
+    return;
+
+  wbook_pool_work(pool);
+  for (i = 0; i < pool->nthreads; i++)
+    pthread_join(pool->threads[i], NULL);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->threads);
+#else
+  (void)pool;
+#endif
+}
+
 /*
  * wbook_store_workbook(struct wbookctx *wbook)
  *
@@ -207,12 +417,13 @@ void wbook_calc_sheet_offsets(struct wbookctx *wbook)
 void wbook_store_workbook(struct wbookctx *wbook)
 {
   struct owctx *ole = wbook->OLEwriter;
+  struct wbook_pool pool;
   int i;
 
-  /* Call the finalization methods for each worksheet */
-  for (i = 0; i < wbook->sheetcount; i++) {
-    wsheet_close(wbook->sheets[i]);
-  }
+  /* Call the finalization methods for each worksheet.  None of the
+   * globals up to the sheet offsets depend on them, so with threads the
+   * sheets are closed while the globals are built. */
+  wbook_pool_start(wbook, &pool);
 
   /* Add workbook globals */
   bw_store_bof(wbook->biff, 0x0005);
@@ -223,6 +434,7 @@ void wbook_store_workbook(struct wbookctx *wbook)
   wbook_store_all_num_formats(wbook);
   wbook_store_all_xfs(wbook);
   wbook_store_all_styles(wbook);
+  wbook_pool_finish(&pool);
   wbook_calc_sheet_offsets(wbook);
 
   /* Add BOUNDSHEET records */
@@ -238,12 +450,17 @@ void wbook_store_workbook(struct wbookctx *wbook)
     ow_write(ole, wbook->biff->data, wbook->biff->datasize);
 
     for (i = 0; i < wbook->sheetcount; i++) {
-      unsigned char *tmp;
+      struct wsheetctx *ws = wbook->sheets[i];
+      const unsigned char *data;
       size_t size;
 
-      while ((tmp = wsheet_get_data(wbook->sheets[i], &size))) {
-        ow_write(ole, tmp, size);
-        free(tmp);
+      while ((data = wsheet_get_data(ws, &size))) {
+        ow_write(ole, data, size);
+
+        /* Once the header is out, a body kept in a temporary file can be
+         * copied to the output by the kernel */
+        if (ws->using_tmpfile == 1 && wsheet_send_data(ws, ow_fileno(ole)) == 0)
+          break;
       }
     }
   }
@@ -285,6 +502,8 @@ void wbook_store_all_fonts(struct wbookctx *wbook)
   int index;
 
   font = fmt_get_font(wbook->tmp_format);
+  if (font == NULL)
+    return;
   for (i = 1; i < 6; i++) {
     bw_append(wbook->biff, font->data, font->len);
   }
@@ -310,6 +529,8 @@ void wbook_store_all_fonts(struct wbookctx *wbook)
       wbook->formats[i]->font_index = index;
       index++;
       font = fmt_get_font(wbook->formats[i]);
+      if (font == NULL)
+        continue;
       bw_append(wbook->biff, font->data, font->len);
       pkt_free(font);
     }
@@ -426,9 +647,8 @@ void wbook_store_boundsheet(struct wbookctx *wbook, char *sname, int offset)
   pkt_add32_le(pkt, offset);  /* Location of worksheet BOF */
   pkt_add16_le(pkt, grbit);   /* Sheet identifier */
   pkt_add8(pkt, cch); /* Length of sheet name */
-  pkt_addraw(pkt, (unsigned char *)sname, cch);
-
-  bw_append(wbook->biff, pkt->data, pkt->len);
+  if (pkt_addraw(pkt, (unsigned char *)sname, cch) == 0)
+    bw_append(wbook->biff, pkt->data, pkt->len);
   pkt_free(pkt);
 
 }
@@ -449,9 +669,8 @@ static void wbook_store_num_format(struct wbookctx *wbook, char *format, int ind
   /* Write data */
   pkt_add16_le(pkt, index);
   pkt_add8(pkt, cch);
-  pkt_addraw(pkt, (unsigned char *)format, cch);
-
-  bw_append(wbook->biff, pkt->data, pkt->len);
+  if (pkt_addraw(pkt, (unsigned char *)format, cch) == 0)
+    bw_append(wbook->biff, pkt->data, pkt->len);
 
   pkt_free(pkt);
 }
@@ -16,83 +16,61 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#endif
+
 #include "formula.h"
+#include "numparse.h"
 #include "worksheet.h"
 #include "stream.h"
 
-#define XLS_ROWMAX 65536
-#define XLS_COLMAX 256
-#define XLS_STRMAX 255
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Records of a worksheet backed by a temporary file are gathered in a
+ * buffer of this size before being written out. */
+#define WSHEET_SPILLSZ 65536
+
+/* Size of the chunks a temporary file is read back in */
+#define WSHEET_READSZ (1024 * 1024)
+
+/* wsheet_get_data() progress */
+#define WSHEET_DRAIN_HEAD 0
+#define WSHEET_DRAIN_BODY 1
+#define WSHEET_DRAIN_FILE 2
+#define WSHEET_DRAIN_DONE 3
 
-int xls_init(struct wsheetctx *xls, char *name, int index, int activesheet, int firstsheet, struct xl_format *url, int store_in_memory);
+int xls_init(struct wsheetctx *xls, const char *name, int index, int activesheet, int firstsheet, struct xl_format *url, int store_in_memory);
 void wsheet_store_dimensions(struct wsheetctx *xls);
 void wsheet_store_window2(struct wsheetctx *xls);
 void wsheet_store_selection(struct wsheetctx *xls, int frow, int fcol, int lrow, int lcol);
 void wsheet_store_colinfo(struct wsheetctx *wsheet, struct col_info *ci);
 void wsheet_store_defcol(struct wsheetctx *wsheet);
-void wsheet_append(void *xlsctx, void *data, size_t sz);
+int wsheet_spill(struct bwctx *bw, size_t size);
+int wsheet_grow(struct bwctx *bw, size_t size);
 
 extern int bw_init(struct bwctx *bw);
 
-#ifdef WIN32
-#include <io.h>
-#include <windows.h>
-#define tmpfile() _xls_win32_tmpfile()
-
-FILE *_xls_win32_tmpfile(void)
-{
-  char path_name[MAX_PATH + 1];
-  char file_name[MAX_PATH + 1];
-  DWORD path_len;
-  HANDLE handle;
-  int fd;
-  FILE *fp;
-
-
-  path_len = GetTempPath(MAX_PATH, path_name);
-  if (path_len <= 0 || path_len >= MAX_PATH)
-    return NULL;
-
-  if (GetTempFileName(path_name, "xl_", 0, file_name) == 0)
-    return NULL;
-
-  handle = CreateFile(file_name, GENERIC_READ | GENERIC_WRITE,
-      0, NULL, CREATE_ALWAYS,
-      FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE,
-      NULL);
-
-  if (handle == INVALID_HANDLE_VALUE) {
-    DeleteFile(file_name);
-    return NULL;
-  }
-
-  fd = _open_osfhandle((intptr_t)handle, 0);
-  if (fd < 0) {
-    CloseHandle(handle);
-    return NULL;
-  }
-
-  fp = fdopen(fd, "w+b");
-  if (fp == NULL) {
-    _close(fd);
-    return NULL;
-  }
-
-  return fp;
-}
-#endif
-
-struct wsheetctx * wsheet_new(char *name, int index, int activesheet, int firstsheet, struct xl_format *url, int store_in_memory)
+struct wsheetctx * wsheet_new(const char *name, int index, int activesheet, int firstsheet, struct xl_format *url, int store_in_memory)
 {
   struct wsheetctx *xls;
 
   xls = malloc(sizeof(struct wsheetctx));
   bw_init((struct bwctx *)xls);
-  ((struct bwctx *)xls)->append = wsheet_append;
+  bw_init(&xls->head);
   TAILQ_INIT(&xls->colinfos);
 
   if (xls_init(xls, name, index, activesheet, firstsheet, url,
@@ -107,6 +85,9 @@ struct wsheetctx * wsheet_new(char *name, int index, int activesheet, int firsts
 void wsheet_destroy(struct wsheetctx *xls)
 {
   struct col_info *ci;
+
+  wsheet_unbudget(xls);
+
   /* Free the entire tail queue of colinfo records. */
   while ((ci = TAILQ_FIRST(&xls->colinfos))) {
     TAILQ_REMOVE(&xls->colinfos, ci, cis);
@@ -114,15 +95,15 @@ void wsheet_destroy(struct wsheetctx *xls)
   }
 
   /* Free up anything else that was allocated */
+  free(xls->cursor);
   free(xls->name);
-  if (xls->fp) {
-	  fclose(xls->fp);
-  }
+  spill_destroy(xls->sp);
+  free(xls->head.data);
   free(((struct bwctx *)xls)->data);
   free(xls);
 }
 
-int xls_init(struct wsheetctx *xls, char *name, int index, int activesheet,
+int xls_init(struct wsheetctx *xls, const char *name, int index, int activesheet,
     int firstsheet, struct xl_format *url, int store_in_memory)
 {
   int rowmax = 65536;
@@ -134,9 +115,12 @@ int xls_init(struct wsheetctx *xls, char *name, int index, int activesheet,
   xls->activesheet = activesheet;
   xls->firstsheet = firstsheet;
   xls->url_format = url;
-  xls->using_tmpfile = 1;
+  xls->defaults = NULL;
+  xls->using_tmpfile = !store_in_memory;
 
-  xls->fp = NULL;
+  xls->spillfile = NULL;
+  xls->sp = NULL;
+  xls->budget = NULL;
   xls->fileclosed = 0;
   xls->offset = 0;
   xls->xls_rowmax = rowmax;
@@ -150,37 +134,64 @@ int xls_init(struct wsheetctx *xls, char *name, int index, int activesheet,
   xls->sel_fcol = 0;
   xls->sel_lrow = 0;
   xls->sel_lcol = 0;
+  xls->cursor = NULL;
+  xls->drain = WSHEET_DRAIN_HEAD;
 
-  if (xls->using_tmpfile == 1) {
-    xls->fp = tmpfile();
-    if (xls->fp == NULL)
-      xls->using_tmpfile = 0;
-  }
+  /* The temporary file is created the first time the buffer fills up */
+  if (xls->using_tmpfile == 1)
+    ((struct bwctx *)xls)->spill = wsheet_spill;
 
   return 0;
 }
 
 void wsheet_close(struct wsheetctx *xls)
 {
-  /* Prepend in reverse order !! */
-  wsheet_store_dimensions(xls);
+  struct bwctx *biff = (struct bwctx *)xls;
+
+  /* Finish a row left open by the row cursor */
+  if (xls->cursor != NULL) {
+    xls_row_end(xls->cursor);
+    free(xls->cursor);
+    xls->cursor = NULL;
+  }
+
+  /* Append */
+  wsheet_store_window2(xls);
+  wsheet_store_selection(xls, xls->sel_frow, xls->sel_fcol, xls->sel_lrow, xls->sel_lcol);
+  bw_store_eof(biff);
+  wsheet_unbudget(xls);
+
+  /* Everything up to here belongs in the temporary file.  Flush it and
+   * rewind it for wsheet_get_data().  A sheet that never filled its
+   * buffer has no file and simply stays in memory. */
+  if (xls->using_tmpfile == 1 && xls->sp == NULL)
+    xls->using_tmpfile = 0;
+  biff->spill = NULL;
+
+  if (xls->using_tmpfile == 1) {
+    wsheet_spill(biff, 0);
+    free(biff->data);
+    biff->data = NULL;
+    biff->_sz = 0;
+    biff->_cap = 0;
+    spill_finish(xls->sp);
+  }
+
+  /* The records that start the sheet are built in their own buffer, which
+   * wsheet_get_data() hands out ahead of the body.  Closing a sheet costs
+   * the size of its header rather than a copy of everything in it. */
+  bw_store_bof(&xls->head, 0x0010);
 
-  /* Prepend the COLINFO records if they exist */
   if (!TAILQ_EMPTY(&xls->colinfos)) {
     struct col_info *ci;
-    TAILQ_FOREACH(ci, &xls->colinfos, cis) {
+    wsheet_store_defcol(xls);
+    TAILQ_FOREACH_REVERSE(ci, &xls->colinfos, colinfo_list, cis) {
       wsheet_store_colinfo(xls, ci);
     }
-    wsheet_store_defcol(xls);
   }
 
-  /* Prepend in reverse order!! */
-  bw_store_bof((struct bwctx *)xls, 0x0010);
-
-  /* Append */
-  wsheet_store_window2(xls);
-  wsheet_store_selection(xls, xls->sel_frow, xls->sel_fcol, xls->sel_lrow, xls->sel_lcol);
-  bw_store_eof((struct bwctx *)xls);
+  wsheet_store_dimensions(xls);
+  biff->datasize += xls->head.datasize;
 }
 
 void wsheet_set_selection(struct wsheetctx *xls, int frow, int fcol, int lrow, int lcol)
@@ -199,22 +210,22 @@ void wsheet_store_dimensions(struct wsheetctx *xls)
   uint16_t name = 0x0000; /* Record identifier */
   uint16_t length = 0x000A; /* Number of bytes to follow */
   uint16_t reserved = 0x0000; /* Reserved by Excel */
-  struct pkt *pkt;
+  unsigned char buf[14];
+  struct pkt pkt;
 
-  pkt = pkt_init(14, FIXED_PACKET);
+  pkt_attach(&pkt, buf, sizeof(buf));
 
   /* Write header */
-  pkt_add16_le(pkt, name);
-  pkt_add16_le(pkt, length);
+  pkt_add16_le(&pkt, name);
+  pkt_add16_le(&pkt, length);
 
   /* Write data */
-  pkt_add16_le(pkt, xls->dim_rowmin);
-  pkt_add16_le(pkt, xls->dim_rowmax);
-  pkt_add16_le(pkt, xls->dim_colmin);
-  pkt_add16_le(pkt, xls->dim_colmax);
-  pkt_add16_le(pkt, reserved);
-  bw_prepend((struct bwctx *)xls, pkt->data, pkt->len);
-  pkt_free(pkt);
+  pkt_add16_le(&pkt, xls->dim_rowmin);
+  pkt_add16_le(&pkt, xls->dim_rowmax);
+  pkt_add16_le(&pkt, xls->dim_colmin);
+  pkt_add16_le(&pkt, xls->dim_colmax);
+  pkt_add16_le(&pkt, reserved);
+  bw_append(&xls->head, pkt.data, pkt.len);
 }
 
 /****************************************************************************
@@ -230,60 +241,147 @@ void wsheet_store_window2(struct wsheetctx *xls)
   uint16_t rwTop = 0x0000; /* Top row visible in window */
   uint16_t colLeft = 0x0000; /* Leftmost column visible in window */
   uint32_t rgbHdr = 0x00000000; /* Row/column heading and gridline color */
-  struct pkt *pkt;
+  struct bwctx *biff = (struct bwctx *)xls;
+  unsigned char *p;
 
-  pkt = pkt_init(14, FIXED_PACKET);
+  p = bw_reserve(biff, 14);
+  if (p == NULL)
+    return;
 
   if (xls->activesheet == xls->index) {
     grbit = 0x06B6;
   }
 
   /* Write header */
-  pkt_add16_le(pkt, name);
-  pkt_add16_le(pkt, length);
+  p = xl_put16_le(p, name);
+  p = xl_put16_le(p, length);
 
   /* Write data */
-  pkt_add16_le(pkt, grbit);
-  pkt_add16_le(pkt, rwTop);
-  pkt_add16_le(pkt, colLeft);
-  pkt_add32_le(pkt, rgbHdr);
-  wsheet_append(xls, pkt->data, pkt->len);
-  pkt_free(pkt);
+  p = xl_put16_le(p, grbit);
+  p = xl_put16_le(p, rwTop);
+  p = xl_put16_le(p, colLeft);
+  p = xl_put32_le(p, rgbHdr);
+  bw_commit(biff, 14);
 }
 
-/* Retrieves data from memory in one chunk, or from disk in 4096
- * sized chunks. */
-unsigned char *wsheet_get_data(struct wsheetctx *ws, size_t *sz)
+/* Hands out the sheet's data once it is closed, one piece per call: the
+ * header, then the body as it was buffered in memory or read back from the
+ * temporary file in WSHEET_READSZ chunks.  The returned data belongs to
+ * the sheet and stays valid until the next call, which releases it.
+ * Returns NULL when everything has been handed out. */
+const unsigned char *wsheet_get_data(struct wsheetctx *ws, size_t *sz)
 {
-  unsigned char *tmp;
   struct bwctx *biff = (struct bwctx *)ws;
+  const unsigned char *data;
+  size_t bytes_read;
+
+  switch (ws->drain) {
+  case WSHEET_DRAIN_HEAD:
+    ws->drain = WSHEET_DRAIN_BODY;
+    if (ws->head._sz > 0) {
+      *sz = ws->head._sz;
+      return ws->head.data;
+    }
+    /* FALLTHROUGH */
+  case WSHEET_DRAIN_BODY:
+    free(ws->head.data);
+    ws->head.data = NULL;
+    ws->head._sz = ws->head._cap = 0;
+    ws->drain = WSHEET_DRAIN_DONE;
+    if (ws->using_tmpfile == 0) {
+      if (biff->_sz == 0)
+        break;
+      *sz = biff->_sz;
+      return biff->data;
+    }
 
-  /* Return data stored in memory */
-  if (biff->data) {
-    tmp = malloc(biff->_sz);
-    memcpy(tmp, biff->data, biff->_sz);
-    *sz = biff->_sz;
-    free(biff->data);
-    biff->data = NULL;
-    if (ws->using_tmpfile == 1) {
-      fseek(ws->fp, 0, SEEK_SET);
+    /* Reuse the record buffer to read the file back, unless the file
+     * is mapped */
+    if ((ws->sp->file->backend == XL_SPILL_STDIO || ws->sp->file->compress) &&
+        bw_resize(biff, WSHEET_READSZ) == -1)
+      break;
+    ws->drain = WSHEET_DRAIN_FILE;
+    /* FALLTHROUGH */
+  case WSHEET_DRAIN_FILE:
+    data = spill_read(ws->sp, biff->data, biff->_cap, &bytes_read);
+    if (data != NULL) {
+      *sz = bytes_read;
+      return data;
     }
-    return tmp;
+    ws->drain = WSHEET_DRAIN_DONE;
+    break;
   }
 
-  if (ws->using_tmpfile == 1) {
-    size_t bytes_read;
-    tmp = malloc(4096);
-    bytes_read = fread(tmp, 1, 4096, ws->fp);
-    *sz = bytes_read;
-    if (bytes_read <= 0) {
-      free(tmp);
-      return NULL;
+  free(biff->data);
+  biff->data = NULL;
+  biff->_sz = biff->_cap = 0;
+  *sz = 0;
+  return NULL;
+}
+
+/* Copies the body of a sheet kept in a temporary file straight to fd,
+ * without it passing through user space.  Only valid once the header has
+ * been taken with wsheet_get_data().  Returns 0 when the whole body has
+ * been sent; otherwise -1, and wsheet_get_data() carries on from wherever
+ * the copy stopped. */
+int wsheet_send_data(struct wsheetctx *ws, int fd)
+{
+#ifdef __linux__
+  loff_t off, end;
+  size_t start, len;
+  ssize_t n = -1;
+  int in;
+  int use_sendfile = 0;
+
+  if (fd < 0 || ws->using_tmpfile == 0 || ws->drain != WSHEET_DRAIN_BODY ||
+      ws->sp->file->compress)
+    return -1;
+
+  /* The body is spread over extents of the shared temporary file */
+  in = spill_fd(ws->sp);
+  while (spill_extent(ws->sp, &start, &len) == 0) {
+    off = start;
+    end = start + len;
+    while (off < end) {
+      len = end - off;
+
+      if (!use_sendfile) {
+        n = copy_file_range(in, &off, fd, NULL, len, 0);
+        if (n == -1 && (errno == EXDEV || errno == EINVAL ||
+              errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF)) {
+          use_sendfile = 1;
+          continue;
+        }
+      } else {
+        off_t soff = off;
+        n = sendfile(fd, in, &soff, len);
+        if (n > 0)
+          off = soff;
+      }
+
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
     }
-    return tmp;
+
+    /* Leave the read position where the copy stopped for
+     * wsheet_get_data() */
+    spill_skip(ws->sp, off - start);
+    if (off < end)
+      return -1;
   }
 
-  return NULL;
+  free(ws->head.data);
+  ws->head.data = NULL;
+  ws->head._sz = ws->head._cap = 0;
+  ws->drain = WSHEET_DRAIN_DONE;
+  return 0;
+#else
+  (void)ws;
+  (void)fd;
+  return -1;
+#endif
 }
 
 int wsheet_xf(struct xl_format *fmt)
@@ -294,29 +392,355 @@ int wsheet_xf(struct xl_format *fmt)
   return 0x0F;
 }
 
-void wsheet_append(void *xlsctx, void *data, size_t sz)
+/* Spill handler for worksheets backed by a temporary file: write out the
+ * buffered records and reuse the buffer for the ones that follow. */
+int wsheet_spill(struct bwctx *bw, size_t size)
 {
-  struct wsheetctx *xls = (struct wsheetctx *)xlsctx;
+  struct wsheetctx *xls = (struct wsheetctx *)bw;
+
+  if (bw->_sz > 0) {
+    if (xls->sp == NULL) {
+      if (xls->spillfile != NULL)
+        xls->sp = spill_new(xls->spillfile);
+
+      /* No temporary file: keep the sheet in memory instead */
+      if (xls->sp == NULL) {
+        xls->using_tmpfile = 0;
+        bw->spill = NULL;
+        return bw_resize(bw, bw->_sz + size);
+      }
+    }
 
-  if (!xls->using_tmpfile) {
-    bw_append((struct bwctx *)xls, data, sz);
-  } else {
-    fwrite(data, sz, 1, xls->fp);
-    /* TODO determine if below line is really needed */
-    ((struct bwctx *)xls)->datasize += sz;
+    if (spill_write(xls->sp, bw->data, bw->_sz) == -1)
+      return -1;
+    bw->_sz = 0;
   }
+
+  if (size < WSHEET_SPILLSZ)
+    size = WSHEET_SPILLSZ;
+
+  return bw_resize(bw, size);
+}
+
+/* Keep the sheet in memory, sharing budget with the other sheets of its
+ * workbook.  Whenever the sheets together go over it the biggest are
+ * moved to temporary files. */
+void wsheet_set_budget(struct wsheetctx *xls, struct xl_budget *budget)
+{
+  struct bwctx *bw = (struct bwctx *)xls;
+
+  if (xls->budget != NULL || xls->sp != NULL)
+    return;
+
+  xls->using_tmpfile = 0;
+  xls->budget = budget;
+  TAILQ_INSERT_TAIL(&budget->sheets, xls, budget_link);
+  budget->used += bw->_cap;
+  bw->spill = wsheet_grow;
+}
+
+/* Take the sheet off its budget.  It stays in memory and grows as it
+ * needs to. */
+void wsheet_unbudget(struct wsheetctx *xls)
+{
+  if (xls->budget == NULL)
+    return;
+
+  TAILQ_REMOVE(&xls->budget->sheets, xls, budget_link);
+  xls->budget->used -= ((struct bwctx *)xls)->_cap;
+  xls->budget = NULL;
+  ((struct bwctx *)xls)->spill = NULL;
+}
+
+/* The workbook's built in format which (XLS_FMT_DATE, ...), adding it to
+ * the workbook if no sheet has used it yet.  NULL for a sheet that has no
+ * workbook or if the format cannot be added. */
+struct xl_format *wsheet_default_format(struct wsheetctx *xls, int which)
+{
+  struct xl_defaults *d = xls->defaults;
+
+  if (d == NULL || which < 0 || which >= XLS_FMT_COUNT)
+    return NULL;
+  if (d->fmt[which] == NULL)
+    d->fmt[which] = d->add(d->ctx, which);
+
+  return d->fmt[which];
+}
+
+/* Move a sheet held in memory to a temporary file */
+static int wsheet_evict(struct wsheetctx *xls)
+{
+  struct bwctx *bw = (struct bwctx *)xls;
+
+  if (xls->spillfile == NULL ||
+      (xls->sp = spill_new(xls->spillfile)) == NULL)
+    return -1;
+
+  if (bw->_sz > 0 && spill_write(xls->sp, bw->data, bw->_sz) == -1) {
+    spill_destroy(xls->sp);
+    xls->sp = NULL;
+    return -1;
+  }
+
+  wsheet_unbudget(xls);
+  free(bw->data);
+  bw->data = NULL;
+  bw->_sz = 0;
+  bw->_cap = 0;
+  xls->using_tmpfile = 1;
+  bw->spill = wsheet_spill;
+  return 0;
+}
+
+/* Growth handler for sheets under a memory budget */
+int wsheet_grow(struct bwctx *bw, size_t size)
+{
+  struct wsheetctx *xls = (struct wsheetctx *)bw;
+  struct xl_budget *budget = xls->budget;
+  struct wsheetctx *ws, *victim;
+  size_t cap = bw->_cap;
+
+  if (bw_resize(bw, bw->_sz + size) == -1)
+    return -1;
+  budget->used += bw->_cap - cap;
+
+  while (budget->limit > 0 && budget->used > budget->limit) {
+    victim = NULL;
+    TAILQ_FOREACH(ws, &budget->sheets, budget_link) {
+      if (victim == NULL || ws->base._cap > victim->base._cap)
+        victim = ws;
+    }
+    if (victim == NULL || wsheet_evict(victim) == -1)
+      break;
+  }
+
+  /* This sheet may have been the one moved out */
+  if (xls->using_tmpfile == 1)
+    return wsheet_spill(bw, size);
+
+  return 0;
+}
+
+/* Encode num as an RK value if that can be done without losing precision.
+ * An RK is a 32 bit value holding either a 30 bit signed integer or the
+ * top 30 bits of a double, optionally divided by 100 (bit 0).  Bit 1 is
+ * set for the integer form.  Returns 1 and fills rk on success. */
+static int wsheet_rk(double num, uint32_t *rk)
+{
+  uint64_t bits;
+  double n100;
+  int32_t i;
+
+  /* 30 bit integers */
+  if (num >= -536870912.0 && num <= 536870911.0) {
+    i = (int32_t)num;
+    if ((double)i == num) {
+      *rk = ((uint32_t)i << 2) | 0x02;
+      return 1;
+    }
+  }
+
+  memcpy(&bits, &num, sizeof(bits));
+  if ((bits & 0x7FF0000000000000ULL) == 0x7FF0000000000000ULL)
+    return 0;  /* Leave NaN and infinity to the NUMBER record */
+
+  /* Doubles whose low 34 bits are zero */
+  if ((bits & 0x3FFFFFFFFULL) == 0) {
+    *rk = (uint32_t)(bits >> 32);
+    return 1;
+  }
+
+  /* Integral hundredths, such as money amounts */
+  n100 = num * 100;
+  if (n100 >= -536870912.0 && n100 <= 536870911.0) {
+    i = (int32_t)(n100 < 0 ? n100 - 0.5 : n100 + 0.5);
+    if ((double)i / 100 == num) {
+      *rk = ((uint32_t)i << 2) | 0x03;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* Encode a 14 byte RK record, the 10 byte form of NUMBER (BIFF3-BIFF8) */
+XL_INLINE unsigned char *wsheet_put_rk(unsigned char *p, int row, int col, uint16_t xf, uint32_t rk)
+{
+  /* Write header */
+  p = xl_put16_le(p, 0x027E); /* Record identifier */
+  p = xl_put16_le(p, 0x000A); /* Number of bytes to follow */
+
+  /* Write data */
+  p = xl_put16_le(p, row);
+  p = xl_put16_le(p, col);
+  p = xl_put16_le(p, xf);
+  return xl_put32_le(p, rk);
+}
+
+/* Encode an 18 byte NUMBER record holding the full 64 bit double, given
+ * as 8 bytes already in BIFF byte order (BIFF3-BIFF8) */
+XL_INLINE unsigned char *wsheet_put_number_le(unsigned char *p, int row, int col, uint16_t xf, const unsigned char *num)
+{
+  /* Write header */
+  p = xl_put16_le(p, 0x0203); /* Record identifier */
+  p = xl_put16_le(p, 0x000E); /* Number of bytes to follow */
+
+  /* Write data */
+  p = xl_put16_le(p, row);
+  p = xl_put16_le(p, col);
+  p = xl_put16_le(p, xf);
+
+  /* Write the number */
+  return xl_putraw(p, num, 8);
+}
+
+XL_INLINE unsigned char *wsheet_put_number(unsigned char *p, int row, int col, uint16_t xf, double num)
+{
+  unsigned char le[8];
+
+  xl_putdouble(le, num);
+  return wsheet_put_number_le(p, row, col, xf, le);
+}
+
+/* Write an RK record */
+static int wsheet_store_rk(struct bwctx *biff, int row, int col, uint16_t xf, uint32_t rk)
+{
+  unsigned char *p;
+
+  p = bw_reserve(biff, 14);
+  if (p == NULL)
+    return -1;
+
+  wsheet_put_rk(p, row, col, xf, rk);
+  bw_commit(biff, 14);
+
+  return 0;
+}
+
+/* Write a NUMBER record */
+static int wsheet_store_number(struct bwctx *biff, int row, int col, uint16_t xf, double num)
+{
+  unsigned char *p;
+
+  p = bw_reserve(biff, 18);
+  if (p == NULL)
+    return -1;
+
+  wsheet_put_number(p, row, col, xf, num);
+  bw_commit(biff, 18);
+
+  return 0;
+}
+
+/* Write a LABEL record, truncating str to len bytes (BIFF2-BIFF7) */
+static int wsheet_store_label(struct bwctx *biff, int row, int col, uint16_t xf, const char *str, int len)
+{
+  unsigned char *p;
+
+  p = bw_reserve(biff, 12 + len);
+  if (p == NULL)
+    return -1;
+
+  /* Write header */
+  p = xl_put16_le(p, 0x0204); /* Record identifier */
+  p = xl_put16_le(p, 8 + len); /* Number of bytes to follow */
+
+  /* Write data */
+  p = xl_put16_le(p, row);
+  p = xl_put16_le(p, col);
+  p = xl_put16_le(p, xf);
+  p = xl_put16_le(p, len);
+  xl_putraw(p, str, len);
+  bw_commit(biff, 12 + len);
+
+  return 0;
+}
+
+/* Write a BLANK record, a cell with a format but no value (BIFF3-BIFF8) */
+static int wsheet_store_blank(struct bwctx *biff, int row, int col, uint16_t xf)
+{
+  unsigned char *p;
+
+  p = bw_reserve(biff, 10);
+  if (p == NULL)
+    return -1;
+
+  /* Write header */
+  p = xl_put16_le(p, 0x0201); /* Record identifier */
+  p = xl_put16_le(p, 0x0006); /* Number of bytes to follow */
+
+  /* Write data */
+  p = xl_put16_le(p, row);
+  p = xl_put16_le(p, col);
+  p = xl_put16_le(p, xf);
+
+  bw_commit(biff, 10);
+  return 0;
+}
+
+/* Write a MULBLANK record covering n consecutive blank cells of a row, or
+ * a plain BLANK record when n is 1 (BIFF5-BIFF8) */
+static int wsheet_store_mulblank(struct bwctx *biff, int row, int col, const uint16_t *xfs, int n)
+{
+  unsigned char *p;
+  size_t length = 6 + 2 * n; /* Number of bytes to follow */
+  int i;
+
+  if (n == 1)
+    return wsheet_store_blank(biff, row, col, xfs[0]);
+
+  p = bw_reserve(biff, 4 + length);
+  if (p == NULL)
+    return -1;
+
+  /* Write header */
+  p = xl_put16_le(p, 0x00BE); /* Record identifier */
+  p = xl_put16_le(p, length);
+
+  /* Write data */
+  p = xl_put16_le(p, row);
+  p = xl_put16_le(p, col);
+  for (i = 0; i < n; i++)
+    p = xl_put16_le(p, xfs[i]);
+  p = xl_put16_le(p, col + n - 1); /* Last column */
+
+  bw_commit(biff, 4 + length);
+  return 0;
+}
+
+/* Write a BOOLERR record holding a boolean, or an error value such as
+ * #NUM! when is_error is set (BIFF3-BIFF8) */
+static int wsheet_store_boolerr(struct bwctx *biff, int row, int col, uint16_t xf, int value, int is_error)
+{
+  unsigned char *p;
+
+  p = bw_reserve(biff, 12);
+  if (p == NULL)
+    return -1;
+
+  /* Write header */
+  p = xl_put16_le(p, 0x0205); /* Record identifier */
+  p = xl_put16_le(p, 0x0008); /* Number of bytes to follow */
+
+  /* Write data */
+  p = xl_put16_le(p, row);
+  p = xl_put16_le(p, col);
+  p = xl_put16_le(p, xf);
+  p = xl_put8(p, value);
+  p = xl_put8(p, is_error);
+
+  bw_commit(biff, 12);
+  return 0;
 }
 
 /* Write a double to the specified row and column (zero indexed).
  * An integer can be written as a double.  Excel will display an integer.
- * This writes the Excel NUMBER record to the worksheet. (BIFF3-BIFF8) */
+ * Values that fit are written as an RK record, anything else as a NUMBER
+ * record. */
 int xls_writef_number(struct wsheetctx *xls, int row, int col, double num, struct xl_format *fmt)
 {
-  uint16_t name = 0x0203; /* Record identifier */
-  uint16_t length = 0x000E; /* Number of bytes to follow */
   uint16_t xf; /* The cell format */
-  unsigned char xl_double[8];
-  struct pkt *pkt;
+  uint32_t rk;
   struct bwctx *biff = (struct bwctx *)xls;
 
   if (row >= xls->xls_rowmax) { return -2; }
@@ -328,24 +752,782 @@ int xls_writef_number(struct wsheetctx *xls, int row, int col, double num, struc
 
   xf = wsheet_xf(fmt);
 
-  pkt = pkt_init(0, VARIABLE_PACKET);
+  if (wsheet_rk(num, &rk))
+    return wsheet_store_rk(biff, row, col, xf, rk);
+
+  return wsheet_store_number(biff, row, col, xf, num);
+}
+
+/* Write an integer to the specified row and column (zero indexed).
+ * Integers of up to 30 bits go straight into an RK record, larger ones
+ * are written as a double. */
+int xls_writef_int(struct wsheetctx *xls, int row, int col, int32_t num, struct xl_format *fmt)
+{
+  uint16_t xf; /* The cell format */
+  struct bwctx *biff = (struct bwctx *)xls;
+
+  if (row >= xls->xls_rowmax) { return -2; }
+  if (col >= xls->xls_colmax) { return -2; }
+  if (row < xls->dim_rowmin) { xls->dim_rowmin = row; }
+  if (row > xls->dim_rowmax) { xls->dim_rowmax = row; }
+  if (col < xls->dim_colmin) { xls->dim_colmin = col; }
+  if (col > xls->dim_colmax) { xls->dim_colmax = col; }
+
+  xf = wsheet_xf(fmt);
+
+  if (num >= -536870912 && num <= 536870911)
+    return wsheet_store_rk(biff, row, col, xf, ((uint32_t)num << 2) | 0x02);
+
+  return wsheet_store_number(biff, row, col, xf, num);
+}
+
+/* How each value of a bulk write is stored */
+#define CELL_NUMBER 0
+#define CELL_RK     1
+#define CELL_BLANK  2
+#define CELL_ERROR  3
+
+/* Error codes of a BOOLERR record */
+#define XLS_ERROR_NUM 0x24 /* #NUM! */
+
+/* Classify n values for a bulk write, filling in the RK value of every
+ * cell that has one.  The common 30 bit integer case is tested two values
+ * at a time with SSE2 (or in a loop the compiler can vectorise); the few
+ * values that fail it get the full wsheet_rk() treatment afterwards. */
+static void wsheet_classify(const double *vals, int n, unsigned char *kind, uint32_t *rk)
+{
+  int i = 0;
+
+#ifdef __SSE2__
+  const __m128d lo = _mm_set1_pd(-536870912.0);
+  const __m128d hi = _mm_set1_pd(536870911.0);
+  const __m128i two = _mm_set1_epi32(0x02);
+
+  for (; i + 2 <= n; i += 2) {
+    __m128d v = _mm_loadu_pd(vals + i);
+    __m128d inrange = _mm_and_pd(_mm_cmpge_pd(v, lo), _mm_cmple_pd(v, hi));
+    __m128i iv = _mm_cvttpd_epi32(_mm_and_pd(v, inrange));
+    __m128d exact = _mm_and_pd(_mm_cmpeq_pd(_mm_cvtepi32_pd(iv), v), inrange);
+    int mask = _mm_movemask_pd(exact);
+
+    _mm_storel_epi64((__m128i *)(rk + i), _mm_or_si128(_mm_slli_epi32(iv, 2), two));
+    kind[i] = mask & 1;
+    kind[i + 1] = (mask >> 1) & 1;
+  }
+#endif
+  for (; i < n; i++) {
+    double v = vals[i];
+    int inrange = v >= -536870912.0 && v <= 536870911.0;
+    int32_t iv = (int32_t)(inrange ? v : 0.0);
+
+    rk[i] = ((uint32_t)iv << 2) | 0x02;
+    kind[i] = inrange && (double)iv == v;
+  }
+
+  for (i = 0; i < n; i++) {
+    if (kind[i] == CELL_NUMBER && wsheet_rk(vals[i], &rk[i]))
+      kind[i] = CELL_RK;
+  }
+}
+
+/* Write a MULRK record holding n consecutive RK cells (BIFF5-BIFF8) */
+static int wsheet_store_mulrk(struct bwctx *biff, int row, int col, const uint16_t *xfs, const uint32_t *rk, int n)
+{
+  unsigned char *p;
+  size_t length = 6 + 6 * n; /* Number of bytes to follow */
+  int i;
+
+  p = bw_reserve(biff, 4 + length);
+  if (p == NULL)
+    return -1;
+
   /* Write header */
-  pkt_add16_le(pkt, name);
-  pkt_add16_le(pkt, length);
+  p = xl_put16_le(p, 0x00BD); /* Record identifier */
+  p = xl_put16_le(p, length);
 
   /* Write data */
-  pkt_add16_le(pkt, row);
-  pkt_add16_le(pkt, col);
-  pkt_add16_le(pkt, xf);
+  p = xl_put16_le(p, row);
+  p = xl_put16_le(p, col);
+  for (i = 0; i < n; i++) {
+    p = xl_put16_le(p, xfs[i]);
+    p = xl_put32_le(p, rk[i]);
+  }
+  p = xl_put16_le(p, col + n - 1); /* Last column */
+  bw_commit(biff, 4 + length);
 
-  /* Write the number */
-  memcpy(xl_double, &num, sizeof(xl_double));
-  if (biff->byte_order)
-    reverse(xl_double, sizeof(xl_double));
+  return 0;
+}
+
+/* Store n classified cells of a row starting at col.  Runs of RK values
+ * become a single MULRK (or RK for a run of one) and runs of blanks a
+ * single MULBLANK, the rest are NUMBER or BOOLERR records.  The values
+ * are swapped to BIFF byte order in one pass first, which only costs a
+ * copy on little endian hosts. */
+static int wsheet_store_cells(struct bwctx *biff, int row, int col, const double *vals, const uint16_t *xfs,
+    const unsigned char *kind, const uint32_t *rk, int n)
+{
+  unsigned char nums[XLS_COLMAX * 8];
+  unsigned char *p;
+  int i, run;
+
+  xl_putdoubles(nums, vals, n);
 
-  pkt_addraw(pkt, xl_double, sizeof(xl_double));
-  biff->append(biff, pkt->data, pkt->len);
-  pkt_free(pkt);
+  for (i = 0; i < n; i += run) {
+    int ret;
+
+    run = 1;
+    if (kind[i] == CELL_RK || kind[i] == CELL_BLANK) {
+      while (i + run < n && kind[i + run] == kind[i])
+        run++;
+    }
+
+    switch (kind[i]) {
+    case CELL_RK:
+      if (run == 1)
+        ret = wsheet_store_rk(biff, row, col + i, xfs[i], rk[i]);
+      else
+        ret = wsheet_store_mulrk(biff, row, col + i, xfs + i, rk + i, run);
+      break;
+    case CELL_BLANK:
+      ret = wsheet_store_mulblank(biff, row, col + i, xfs + i, run);
+      break;
+    case CELL_ERROR:
+      ret = wsheet_store_boolerr(biff, row, col + i, xfs[i], XLS_ERROR_NUM, 1);
+      break;
+    default:
+      ret = -1;
+      if ((p = bw_reserve(biff, 18)) != NULL) {
+        wsheet_put_number_le(p, row, col + i, xfs[i], nums + 8 * i);
+        bw_commit(biff, 18);
+        ret = 0;
+      }
+      break;
+    }
+    if (ret != 0)
+      return ret;
+  }
+
+  return 0;
+}
+
+/* Store n numbers of a row starting at col.  Callers have already checked
+ * the range and updated the dimensions. */
+static int wsheet_store_numbers(struct wsheetctx *xls, int row, int col, const double *vals, const uint16_t *xfs, int n)
+{
+  unsigned char kind[XLS_COLMAX];
+  uint32_t rk[XLS_COLMAX];
+
+  wsheet_classify(vals, n, kind, rk);
+
+  return wsheet_store_cells((struct bwctx *)xls, row, col, vals, xfs, kind, rk, n);
+}
+
+/* Write n doubles to a row, starting at first_col, all with the same
+ * format.  Equivalent to n xls_writef_number() calls but runs of values
+ * that fit an RK share one MULRK record. */
+int xls_write_row_numbers(struct wsheetctx *xls, int row, int first_col, const double *vals, int n, struct xl_format *fmt)
+{
+  uint16_t xfs[XLS_COLMAX];
+  uint16_t xf;
+  int i;
+
+  if (n <= 0) { return 0; }
+  if (row < 0 || first_col < 0 || n > XLS_COLMAX) { return -2; }
+  if (row >= xls->xls_rowmax) { return -2; }
+  if (first_col + n > xls->xls_colmax) { return -2; }
+  if (row < xls->dim_rowmin) { xls->dim_rowmin = row; }
+  if (row > xls->dim_rowmax) { xls->dim_rowmax = row; }
+  if (first_col < xls->dim_colmin) { xls->dim_colmin = first_col; }
+  if (first_col + n - 1 > xls->dim_colmax) { xls->dim_colmax = first_col + n - 1; }
+
+  xf = wsheet_xf(fmt);
+  for (i = 0; i < n; i++)
+    xfs[i] = xf;
+
+  return wsheet_store_numbers(xls, row, first_col, vals, xfs, n);
+}
+
+/* Same as xls_write_row_numbers() with a format per cell.  fmts may be
+ * NULL, as may any of its entries. */
+int xls_write_row_numbers_fmt(struct wsheetctx *xls, int row, int first_col, const double *vals, int n, struct xl_format *const *fmts)
+{
+  uint16_t xfs[XLS_COLMAX];
+  int i;
+
+  if (n <= 0) { return 0; }
+  if (row < 0 || first_col < 0 || n > XLS_COLMAX) { return -2; }
+  if (row >= xls->xls_rowmax) { return -2; }
+  if (first_col + n > xls->xls_colmax) { return -2; }
+  if (row < xls->dim_rowmin) { xls->dim_rowmin = row; }
+  if (row > xls->dim_rowmax) { xls->dim_rowmax = row; }
+  if (first_col < xls->dim_colmin) { xls->dim_colmin = first_col; }
+  if (first_col + n - 1 > xls->dim_colmax) { xls->dim_colmax = first_col + n - 1; }
+
+  for (i = 0; i < n; i++)
+    xfs[i] = wsheet_xf(fmts ? fmts[i] : NULL);
+
+  return wsheet_store_numbers(xls, row, first_col, vals, xfs, n);
+}
+
+/* Write a dense rows x cols matrix of doubles with its top left corner at
+ * (top, left).  data is stored by row (XLS_ROW_MAJOR) or by column
+ * (XLS_COL_MAJOR); either way the cells are written a row at a time.
+ * NaN leaves a formatted blank cell and an infinity becomes a #NUM!
+ * error cell. */
+int xls_write_matrix(struct wsheetctx *xls, int top, int left, int rows, int cols, const double *data, int layout, struct xl_format *fmt)
+{
+  struct bwctx *biff = (struct bwctx *)xls;
+  uint16_t xfs[XLS_COLMAX];
+  unsigned char kind[XLS_COLMAX];
+  uint32_t rk[XLS_COLMAX];
+  double buf[XLS_COLMAX];
+  uint16_t xf;
+  int r, c;
+
+  if (rows <= 0 || cols <= 0) { return 0; }
+  if (top < 0 || left < 0 || cols > XLS_COLMAX) { return -2; }
+  if (top + rows > xls->xls_rowmax) { return -2; }
+  if (left + cols > xls->xls_colmax) { return -2; }
+  if (top < xls->dim_rowmin) { xls->dim_rowmin = top; }
+  if (top + rows - 1 > xls->dim_rowmax) { xls->dim_rowmax = top + rows - 1; }
+  if (left < xls->dim_colmin) { xls->dim_colmin = left; }
+  if (left + cols - 1 > xls->dim_colmax) { xls->dim_colmax = left + cols - 1; }
+
+  xf = wsheet_xf(fmt);
+  for (c = 0; c < cols; c++)
+    xfs[c] = xf;
+
+  for (r = 0; r < rows; r++) {
+    const double *vals;
+    int ret;
+
+    if (layout == XLS_COL_MAJOR) {
+      for (c = 0; c < cols; c++)
+        buf[c] = data[(size_t)c * rows + r];
+      vals = buf;
+    } else {
+      vals = data + (size_t)r * cols;
+    }
+
+    wsheet_classify(vals, cols, kind, rk);
+    for (c = 0; c < cols; c++) {
+      if (kind[c] == CELL_NUMBER && !isfinite(vals[c]))
+        kind[c] = isnan(vals[c]) ? CELL_BLANK : CELL_ERROR;
+    }
+
+    ret = wsheet_store_cells(biff, top + r, left, vals, xfs, kind, rk, cols);
+    if (ret != 0)
+      return ret;
+  }
+
+  return 0;
+}
+
+/* Start writing cells of row from column 0 onwards, finishing any row
+ * the cursor still has open.  Cells are added left to right with the
+ * xls_row_add_*() calls; the row and column limits are only checked
+ * here and against the fixed column count.  Returns NULL if row is out
+ * of range or the cursor cannot be allocated.  The cursor belongs to the
+ * worksheet, so only one row can be open at a time; it is allocated by
+ * the first call and kept until the sheet is closed, so sheets that
+ * never use it do not carry one. */
+struct xl_row *xls_row_begin(struct wsheetctx *xls, int row)
+{
+  struct xl_row *cur = xls->cursor;
+
+  if (cur != NULL)
+    xls_row_end(cur);
+
+  if (row < 0 || row >= xls->xls_rowmax)
+    return NULL;
+
+  if (cur == NULL) {
+    cur = malloc(sizeof(struct xl_row));
+    if (cur == NULL)
+      return NULL;
+    cur->ws = xls;
+    xls->cursor = cur;
+  }
+
+  cur->row = row;
+  cur->col = 0;
+  cur->first_col = -1;
+  cur->last_col = -1;
+  cur->run_len = 0;
+
+  return cur;
+}
+
+/* Write out the pending run of RK or blank cells */
+static int wsheet_row_flush(struct xl_row *cur)
+{
+  struct bwctx *biff = (struct bwctx *)cur->ws;
+  int n = cur->run_len;
+
+  if (n == 0)
+    return 0;
+
+  cur->run_len = 0;
+  if (cur->run_kind == CELL_BLANK)
+    return wsheet_store_mulblank(biff, cur->row, cur->run_col, cur->run_xf, n);
+  if (n == 1)
+    return wsheet_store_rk(biff, cur->row, cur->run_col, cur->run_xf[0], cur->run_rk[0]);
+  return wsheet_store_mulrk(biff, cur->row, cur->run_col, cur->run_xf, cur->run_rk, n);
+}
+
+/* Claim the next column of the cursor, flushing the pending run if the
+ * new cell of this kind cannot extend it.  Returns the column or -2 if
+ * the row is full. */
+static int wsheet_row_next(struct xl_row *cur, int kind)
+{
+  int col = cur->col;
+
+  if (col >= cur->ws->xls_colmax)
+    return -2;
+
+  if (cur->run_len > 0 && (cur->run_kind != kind || cur->run_col + cur->run_len != col)) {
+    int ret = wsheet_row_flush(cur);
+    if (ret != 0)
+      return ret;
+  }
+
+  if (cur->first_col < 0)
+    cur->first_col = col;
+  cur->last_col = col;
+  cur->col++;
+
+  return col;
+}
+
+/* Add a number in the next column of the cursor's row */
+int xls_row_add_number(struct xl_row *cur, double num, struct xl_format *fmt)
+{
+  uint32_t rk;
+  int col;
+
+  if (wsheet_rk(num, &rk)) {
+    col = wsheet_row_next(cur, CELL_RK);
+    if (col < 0)
+      return col;
+    if (cur->run_len == 0) {
+      cur->run_kind = CELL_RK;
+      cur->run_col = col;
+    }
+    cur->run_xf[cur->run_len] = wsheet_xf(fmt);
+    cur->run_rk[cur->run_len] = rk;
+    cur->run_len++;
+    return 0;
+  }
+
+  col = wsheet_row_next(cur, CELL_NUMBER);
+  if (col < 0)
+    return col;
+
+  return wsheet_store_number((struct bwctx *)cur->ws, cur->row, col, wsheet_xf(fmt), num);
+}
+
+/* Add a string in the next column of the cursor's row.  The string is
+ * truncated to the 255 character LABEL limit. */
+int xls_row_add_string(struct xl_row *cur, const char *str, struct xl_format *fmt)
+{
+  return xls_row_add_string_n(cur, str, strlen(str), fmt);
+}
+
+/* Same as xls_row_add_string() for the first len bytes of str, which
+ * need not be NUL terminated. */
+int xls_row_add_string_n(struct xl_row *cur, const char *str, size_t len, struct xl_format *fmt)
+{
+  int col;
+
+  col = wsheet_row_next(cur, CELL_NUMBER);
+  if (col < 0)
+    return col;
+
+  if (len > (size_t)cur->ws->xls_strmax) len = cur->ws->xls_strmax;
+
+  return wsheet_store_label((struct bwctx *)cur->ws, cur->row, col, wsheet_xf(fmt), str, (int)len);
+}
+
+/* Add a boolean in the next column of the cursor's row */
+int xls_row_add_bool(struct xl_row *cur, int value, struct xl_format *fmt)
+{
+  int col;
+
+  col = wsheet_row_next(cur, CELL_NUMBER);
+  if (col < 0)
+    return col;
+
+  return wsheet_store_boolerr((struct bwctx *)cur->ws, cur->row, col, wsheet_xf(fmt), value != 0, 0);
+}
+
+/* Add a formatted empty cell in the next column of the cursor's row */
+int xls_row_add_blank(struct xl_row *cur, struct xl_format *fmt)
+{
+  int col;
+
+  col = wsheet_row_next(cur, CELL_BLANK);
+  if (col < 0)
+    return col;
+
+  if (cur->run_len == 0) {
+    cur->run_kind = CELL_BLANK;
+    cur->run_col = col;
+  }
+  cur->run_xf[cur->run_len++] = wsheet_xf(fmt);
+
+  return 0;
+}
+
+/* Leave the next n columns of the cursor's row without any record */
+int xls_row_skip(struct xl_row *cur, int n)
+{
+  if (n < 0 || n > cur->ws->xls_colmax - cur->col)
+    return -2;
+
+  cur->col += n;
+  return 0;
+}
+
+/* Write out what is left of the cursor's row and update the sheet
+ * dimensions for it. */
+int xls_row_end(struct xl_row *cur)
+{
+  struct wsheetctx *xls = cur->ws;
+  int ret;
+
+  if (cur->row < 0)
+    return 0;
+
+  ret = wsheet_row_flush(cur);
+
+  if (cur->first_col >= 0) {
+    if (cur->row < xls->dim_rowmin) { xls->dim_rowmin = cur->row; }
+    if (cur->row > xls->dim_rowmax) { xls->dim_rowmax = cur->row; }
+    if (cur->first_col < xls->dim_colmin) { xls->dim_colmin = cur->first_col; }
+    if (cur->last_col > xls->dim_colmax) { xls->dim_colmax = cur->last_col; }
+  }
+
+  cur->row = -1;
+  return ret;
+}
+
+/* Column writes check the range and reserve room for this many records
+ * at a time, then encode them back to back. */
+#define WSHEET_COLBATCH 512
+
+/* Check that n cells down from first_row fit in col and update the
+ * dimensions for them.  Returns -2 if they do not fit. */
+static int wsheet_col_range(struct wsheetctx *xls, int first_row, int col, size_t n)
+{
+  int last_row;
+
+  if (first_row < 0 || first_row >= xls->xls_rowmax) { return -2; }
+  if (n > (size_t)(xls->xls_rowmax - first_row)) { return -2; }
+  if (col < 0 || col >= xls->xls_colmax) { return -2; }
+
+  last_row = first_row + (int)n - 1;
+  if (first_row < xls->dim_rowmin) { xls->dim_rowmin = first_row; }
+  if (last_row > xls->dim_rowmax) { xls->dim_rowmax = last_row; }
+  if (col < xls->dim_colmin) { xls->dim_colmin = col; }
+  if (col > xls->dim_colmax) { xls->dim_colmax = col; }
+
+  return 0;
+}
+
+/* Write n doubles down a column, starting at first_row, all with the same
+ * format.  Consecutive values are stride_bytes apart (0 for a packed
+ * array), so a field of an array of structs can be written directly.
+ * Each value becomes an RK record when it fits, a NUMBER otherwise. */
+int xls_write_col_numbers(struct wsheetctx *xls, int first_row, int col, const double *vals, size_t n, size_t stride_bytes, struct xl_format *fmt)
+{
+  struct bwctx *biff = (struct bwctx *)xls;
+  const unsigned char *src = (const unsigned char *)vals;
+  double buf[WSHEET_COLBATCH];
+  unsigned char nums[WSHEET_COLBATCH * 8];
+  unsigned char kind[WSHEET_COLBATCH];
+  uint32_t rk[WSHEET_COLBATCH];
+  uint16_t xf;
+  int row = first_row;
+  int ret;
+
+  if (n == 0) { return 0; }
+  ret = wsheet_col_range(xls, first_row, col, n);
+  if (ret != 0)
+    return ret;
+
+  if (stride_bytes == 0)
+    stride_bytes = sizeof(double);
+
+  xf = wsheet_xf(fmt);
+
+  while (n > 0) {
+    size_t batch = n < WSHEET_COLBATCH ? n : WSHEET_COLBATCH;
+    unsigned char *start, *p;
+    size_t i;
+
+    start = bw_reserve(biff, 18 * batch);
+    if (start == NULL)
+      return -1;
+
+    /* Gather strided values so they can be classified together */
+    if (stride_bytes == sizeof(double)) {
+      memcpy(buf, src, batch * sizeof(double));
+      src += batch * sizeof(double);
+    } else {
+      for (i = 0; i < batch; i++, src += stride_bytes)
+        memcpy(&buf[i], src, sizeof(double));
+    }
+    wsheet_classify(buf, (int)batch, kind, rk);
+    xl_putdoubles(nums, buf, batch);
+
+    p = start;
+    for (i = 0; i < batch; i++, row++) {
+      if (kind[i] == CELL_RK)
+        p = wsheet_put_rk(p, row, col, xf, rk[i]);
+      else
+        p = wsheet_put_number_le(p, row, col, xf, nums + 8 * i);
+    }
+
+    bw_commit(biff, p - start);
+    n -= batch;
+  }
+
+  return 0;
+}
+
+/* Same as xls_write_col_numbers() for 32 bit integers.  Values of up to
+ * 30 bits become RK records, larger ones NUMBER records. */
+int xls_write_col_ints(struct wsheetctx *xls, int first_row, int col, const int32_t *vals, size_t n, size_t stride_bytes, struct xl_format *fmt)
+{
+  struct bwctx *biff = (struct bwctx *)xls;
+  const unsigned char *src = (const unsigned char *)vals;
+  uint16_t xf;
+  int row = first_row;
+  int ret;
+
+  if (n == 0) { return 0; }
+  ret = wsheet_col_range(xls, first_row, col, n);
+  if (ret != 0)
+    return ret;
+
+  if (stride_bytes == 0)
+    stride_bytes = sizeof(int32_t);
+
+  xf = wsheet_xf(fmt);
+
+  while (n > 0) {
+    size_t batch = n < WSHEET_COLBATCH ? n : WSHEET_COLBATCH;
+    unsigned char *start, *p;
+    size_t i;
+
+    start = bw_reserve(biff, 18 * batch);
+    if (start == NULL)
+      return -1;
+
+    p = start;
+    for (i = 0; i < batch; i++, row++, src += stride_bytes) {
+      int32_t num;
+
+      memcpy(&num, src, sizeof(num));
+      if (num >= -536870912 && num <= 536870911)
+        p = wsheet_put_rk(p, row, col, xf, ((uint32_t)num << 2) | 0x02);
+      else
+        p = wsheet_put_number(p, row, col, xf, num);
+    }
+
+    bw_commit(biff, p - start);
+    n -= batch;
+  }
+
+  return 0;
+}
+
+/* Write n strings down a column.  strs holds n string pointers spaced
+ * stride_bytes apart (0 for a packed array); NULL entries leave their
+ * cell empty.  Strings are truncated to the 255 character LABEL limit. */
+int xls_write_col_strings(struct wsheetctx *xls, int first_row, int col, const char *const *strs, size_t n, size_t stride_bytes, struct xl_format *fmt)
+{
+  struct bwctx *biff = (struct bwctx *)xls;
+  const unsigned char *src = (const unsigned char *)strs;
+  uint16_t xf;
+  int row = first_row;
+  size_t i;
+  int ret;
+
+  if (n == 0) { return 0; }
+  ret = wsheet_col_range(xls, first_row, col, n);
+  if (ret != 0)
+    return ret;
+
+  if (stride_bytes == 0)
+    stride_bytes = sizeof(const char *);
+
+  xf = wsheet_xf(fmt);
+
+  for (i = 0; i < n; i++, row++, src += stride_bytes) {
+    const char *str;
+    size_t len;
+
+    memcpy(&str, src, sizeof(str));
+    if (str == NULL)
+      continue;
+
+    len = strlen(str);
+    if (len > (size_t)xls->xls_strmax) len = xls->xls_strmax;
+
+    ret = wsheet_store_label(biff, row, col, xf, str, (int)len);
+    if (ret != 0)
+      return ret;
+  }
+
+  return 0;
+}
+
+/* Compile a list of struct fields for xls_write_structs().  The record
+ * header, column and XF index of every field are encoded here once, so
+ * writing a struct only stamps in the row and value.  The formats must
+ * already belong to the workbook.  Returns NULL if a column is negative
+ * or memory runs out. */
+struct xl_schema *xls_schema_new(const struct xl_field *fields, int nfields)
+{
+  struct xl_schema *schema;
+  int i;
+
+  if (nfields <= 0)
+    return NULL;
+  for (i = 0; i < nfields; i++) {
+    if (fields[i].col < 0)
+      return NULL;
+  }
+
+  schema = malloc(sizeof(struct xl_schema));
+  if (schema == NULL)
+    return NULL;
+
+  schema->fields = malloc(nfields * sizeof(struct xl_schema_field));
+  if (schema->fields == NULL) {
+    free(schema);
+    return NULL;
+  }
+  schema->nfields = nfields;
+  schema->min_col = fields[0].col;
+  schema->max_col = fields[0].col;
+
+  for (i = 0; i < nfields; i++) {
+    struct xl_schema_field *f = &schema->fields[i];
+    unsigned char *p = f->tmpl;
+
+    f->offset = fields[i].offset;
+    f->type = fields[i].type;
+    f->col = fields[i].col;
+
+    /* Numbers start out as RK, the row writer patches in NUMBER when the
+     * value does not fit.  The length of a LABEL is filled in per row. */
+    p = xl_put16_le(p, f->type == XLS_FIELD_STRING ? 0x0204 : 0x027E);
+    p = xl_put16_le(p, f->type == XLS_FIELD_STRING ? 0x0008 : 0x000A);
+    p = xl_put16_le(p, 0); /* Row */
+    p = xl_put16_le(p, f->col);
+    p = xl_put16_le(p, wsheet_xf(fields[i].fmt));
+
+    if (f->col < schema->min_col) { schema->min_col = f->col; }
+    if (f->col > schema->max_col) { schema->max_col = f->col; }
+  }
+
+  return schema;
+}
+
+void xls_schema_destroy(struct xl_schema *schema)
+{
+  if (schema == NULL)
+    return;
+
+  free(schema->fields);
+  free(schema);
+}
+
+/* Write count structs, one per row starting at first_row, using a schema
+ * from xls_schema_new().  Structs are stride bytes apart from base. */
+int xls_write_structs(struct wsheetctx *xls, int first_row, const struct xl_schema *schema, const void *base, size_t count, size_t stride)
+{
+  struct bwctx *biff = (struct bwctx *)xls;
+  const unsigned char *rec = (const unsigned char *)base;
+  size_t maxrec = 0;
+  int row, last_row, i;
+
+  if (count == 0) { return 0; }
+  if (first_row < 0 || first_row >= xls->xls_rowmax) { return -2; }
+  if (count > (size_t)(xls->xls_rowmax - first_row)) { return -2; }
+  if (schema->max_col >= xls->xls_colmax) { return -2; }
+
+  last_row = first_row + (int)count - 1;
+  if (first_row < xls->dim_rowmin) { xls->dim_rowmin = first_row; }
+  if (last_row > xls->dim_rowmax) { xls->dim_rowmax = last_row; }
+  if (schema->min_col < xls->dim_colmin) { xls->dim_colmin = schema->min_col; }
+  if (schema->max_col > xls->dim_colmax) { xls->dim_colmax = schema->max_col; }
+
+  /* Largest encoding of one struct */
+  for (i = 0; i < schema->nfields; i++)
+    maxrec += schema->fields[i].type == XLS_FIELD_STRING ? 12 + xls->xls_strmax : 18;
+
+  for (row = first_row; row <= last_row; row++, rec += stride) {
+    unsigned char *start, *p;
+
+    start = bw_reserve(biff, maxrec);
+    if (start == NULL)
+      return -1;
+
+    p = start;
+    for (i = 0; i < schema->nfields; i++) {
+      const struct xl_schema_field *f = &schema->fields[i];
+      const unsigned char *src = rec + f->offset;
+      uint32_t rk;
+      int32_t ival;
+      double num;
+      const char *str;
+      size_t len;
+
+      switch (f->type) {
+      case XLS_FIELD_DOUBLE:
+        memcpy(&num, src, sizeof(num));
+        memcpy(p, f->tmpl, 10);
+        xl_put16_le(p + 4, row);
+        if (wsheet_rk(num, &rk)) {
+          p = xl_put32_le(p + 10, rk);
+        } else {
+          xl_put16_le(p, 0x0203);
+          xl_put16_le(p + 2, 0x000E);
+          p = xl_putdouble(p + 10, num);
+        }
+        break;
+      case XLS_FIELD_INT32:
+        memcpy(&ival, src, sizeof(ival));
+        memcpy(p, f->tmpl, 10);
+        xl_put16_le(p + 4, row);
+        if (ival >= -536870912 && ival <= 536870911) {
+          p = xl_put32_le(p + 10, ((uint32_t)ival << 2) | 0x02);
+        } else {
+          xl_put16_le(p, 0x0203);
+          xl_put16_le(p + 2, 0x000E);
+          p = xl_putdouble(p + 10, ival);
+        }
+        break;
+      case XLS_FIELD_STRING:
+        memcpy(&str, src, sizeof(str));
+        if (str == NULL)
+          break;
+        len = strlen(str);
+        if (len > (size_t)xls->xls_strmax) len = xls->xls_strmax;
+        memcpy(p, f->tmpl, 10);
+        xl_put16_le(p + 2, 8 + len);
+        xl_put16_le(p + 4, row);
+        p = xl_put16_le(p + 10, len);
+        p = xl_putraw(p, str, len);
+        break;
+      }
+    }
+
+    bw_commit(biff, p - start);
+  }
 
   return 0;
 }
@@ -358,15 +1540,21 @@ int wsheet_writef_formula(struct wsheetctx *xls, int row, int col, char *formula
   uint16_t name = 0x0006; /* Record identifier */
   uint16_t length = 0x0016; /* Number of bytes to follow */
   uint16_t xf; /* The cell format */
-  struct pkt *pkt;
-  struct pkt *formpkt;
+  unsigned char *p;
+  struct pkt formpkt;
+  unsigned char tokens[FORMULA_MAXLEN];
   struct bwctx *biff = (struct bwctx *)xls;
   int formlen;
   double zero = 0;
-  unsigned char xl_double[8];
 
   if (row >= xls->xls_rowmax) { return -2; }
   if (col >= xls->xls_colmax) { return -2; }
+
+  /* Too long or malformed formulas are rejected */
+  pkt_attach(&formpkt, tokens, sizeof(tokens));
+  if (process_formula(formula, &formpkt) == -1) { return -2; }
+  formlen = formpkt.len;
+
   if (row < xls->dim_rowmin) { xls->dim_rowmin = row; }
   if (row > xls->dim_rowmax) { xls->dim_rowmax = row; }
   if (col < xls->dim_colmin) { xls->dim_colmin = col; }
@@ -374,36 +1562,29 @@ int wsheet_writef_formula(struct wsheetctx *xls, int row, int col, char *formula
 
   xf = wsheet_xf(fmt);
 
-  formpkt = pkt_init(0, VARIABLE_PACKET);
-  process_formula(formula, formpkt);
-  formlen = formpkt->len;
+  p = bw_reserve(biff, 26 + formlen);
+  if (p == NULL)
+    return -1;
 
-  pkt = pkt_init(0, VARIABLE_PACKET);
   /* Write header */
-  pkt_add16_le(pkt, name);
-  pkt_add16_le(pkt, length + formlen);
+  p = xl_put16_le(p, name);
+  p = xl_put16_le(p, length + formlen);
 
   /* Write data */
-  pkt_add16_le(pkt, row);
-  pkt_add16_le(pkt, col);
-  pkt_add16_le(pkt, xf);
+  p = xl_put16_le(p, row);
+  p = xl_put16_le(p, col);
+  p = xl_put16_le(p, xf);
 
   /* Write the number */
-  memcpy(xl_double, &zero, sizeof(xl_double));
-  if (biff->byte_order)
-    reverse(xl_double, sizeof(xl_double));
-
-  pkt_addraw(pkt, xl_double, sizeof(xl_double));
-  pkt_add16_le(pkt, 0x03); /* Option flags */
-  pkt_add32_le(pkt, 0); /* Reserved */
-  pkt_add16_le(pkt, formlen);
+  p = xl_putdouble(p, zero);
+  p = xl_put16_le(p, 0x03); /* Option flags */
+  p = xl_put32_le(p, 0); /* Reserved */
+  p = xl_put16_le(p, formlen);
 
   /* The formula */
-  pkt_addraw(pkt, formpkt->data, formpkt->len);
+  p = xl_putraw(p, formpkt.data, formlen);
 
-  biff->append(biff, pkt->data, pkt->len);
-  pkt_free(pkt);
-  pkt_free(formpkt);
+  bw_commit(biff, 26 + formlen);
 
   return 0;
 }
@@ -411,20 +1592,19 @@ int wsheet_writef_formula(struct wsheetctx *xls, int row, int col, char *formula
 /* Write a string to the specified row and column (zero indexed).
  * NOTE: There is an Excel 5 defined limit of 255 characters.
  * This writes the Excel LABEL record (BIFF3-BIFF5) */
-int xls_writef_string(struct wsheetctx *xls, int row, int col, char *str, struct xl_format *fmt)
+int xls_writef_string(struct wsheetctx *xls, int row, int col, const char *str, struct xl_format *fmt)
 {
-  uint16_t name = 0x0204; /* Record identifier */
-  uint16_t length = 0x0008; /* Number of bytes to follow */
-  uint16_t xf; /* The cell format */
-  int len;
-  struct pkt *pkt;
+  return xls_writef_string_n(xls, row, col, str, strlen(str), fmt);
+}
 
-  len = strlen(str);
+/* As xls_writef_string() but takes the length of str, which need not be
+ * NUL terminated. */
+int xls_writef_string_n(struct wsheetctx *xls, int row, int col, const char *str, size_t len, struct xl_format *fmt)
+{
+  uint16_t xf; /* The cell format */
 
   /* LABEL must be < 255 chars */
-  if (len > xls->xls_strmax) len = xls->xls_strmax;
-
-  length += len;
+  if (len > (size_t)xls->xls_strmax) len = xls->xls_strmax;
 
   if (row >= xls->xls_rowmax) { return -2; }
   if (col >= xls->xls_colmax) { return -2; }
@@ -435,31 +1615,38 @@ int xls_writef_string(struct wsheetctx *xls, int row, int col, char *str, struct
 
   xf = wsheet_xf(fmt);
 
-  pkt = pkt_init(0, VARIABLE_PACKET);
+  return wsheet_store_label((struct bwctx *)xls, row, col, xf, str, (int)len);
+}
 
-  /* Write header */
-  pkt_add16_le(pkt, name);
-  pkt_add16_le(pkt, length);
+/* Write text to the specified row and column as what it looks like: an
+ * integer or decimal number, a percentage such as 12.5%, an ISO 8601
+ * date, date and time or time of day, or else a string.  Numbers are
+ * stored as RK or NUMBER records; unless fmt is given, percentages and
+ * dates get the sheet's built in percent and date formats. */
+int xls_write_auto(struct wsheetctx *xls, int row, int col, const char *text, size_t len, struct xl_format *fmt)
+{
+  double num;
+
+  switch (xl_parse_text(text, len, &num)) {
+  case XL_TEXT_NUMBER:
+    return xls_writef_number(xls, row, col, num, fmt);
+  case XL_TEXT_PERCENT:
+    return xls_writef_number(xls, row, col, num, fmt ? fmt : wsheet_default_format(xls, XLS_FMT_PERCENT));
+  case XL_TEXT_DATE:
+    return xls_writef_number(xls, row, col, num, fmt ? fmt : wsheet_default_format(xls, XLS_FMT_DATE));
+  case XL_TEXT_DATETIME:
+    return xls_writef_number(xls, row, col, num, fmt ? fmt : wsheet_default_format(xls, XLS_FMT_DATETIME));
+  case XL_TEXT_TIME:
+    return xls_writef_number(xls, row, col, num, fmt ? fmt : wsheet_default_format(xls, XLS_FMT_TIME));
+  }
 
-  /* Write data */
-  pkt_add16_le(pkt, row);
-  pkt_add16_le(pkt, col);
-  pkt_add16_le(pkt, xf);
-  pkt_add16_le(pkt, len);
-
-  pkt_addraw(pkt, (unsigned char *)str, len);
-  wsheet_append(xls, pkt->data, pkt->len);
-  pkt_free(pkt);
-  return 0;
+  return xls_writef_string_n(xls, row, col, text, len, fmt);
 }
 
 /* Write Worksheet BLANK record  (BIFF3-8) */
 int xls_write_blank(struct wsheetctx *xls, int row, int col, struct xl_format *fmt)
 {
-  uint16_t name = 0x0201; /* Record identifier */
-  uint16_t length = 0x0006; /* Number of bytes to follow */
   uint16_t xf; /* The cell format */
-  struct pkt *pkt;
 
   if (row >= xls->xls_rowmax) { return -2; }
   if (col >= xls->xls_colmax) { return -2; }
@@ -470,23 +1657,53 @@ int xls_write_blank(struct wsheetctx *xls, int row, int col, struct xl_format *f
 
   xf = wsheet_xf(fmt);
 
-  pkt = pkt_init(10, FIXED_PACKET);
+  return wsheet_store_blank((struct bwctx *)xls, row, col, xf);
+}
 
-  /* Write header */
-  pkt_add16_le(pkt, name);
-  pkt_add16_le(pkt, length);
+/* Format a rectangular range of empty cells, for instance the cells of a
+ * merged or bordered region.  Writes one MULBLANK record per row instead
+ * of a BLANK record per cell. */
+int xls_write_blank_range(struct wsheetctx *xls, int frow, int fcol, int lrow, int lcol, struct xl_format *fmt)
+{
+  uint16_t xfs[XLS_COLMAX];
+  uint16_t xf; /* The cell format */
+  int row, i, tmp;
 
-  /* Write data */
-  pkt_add16_le(pkt, row);
-  pkt_add16_le(pkt, col);
-  pkt_add16_le(pkt, xf);
+  /* Swap rows and columns around */
+  if (frow > lrow) {
+    tmp = frow;
+    frow = lrow;
+    lrow = tmp;
+  }
+
+  if (fcol > lcol) {
+    tmp = fcol;
+    fcol = lcol;
+    lcol = tmp;
+  }
+
+  if (frow < 0 || fcol < 0) { return -2; }
+  if (lrow >= xls->xls_rowmax) { return -2; }
+  if (lcol >= xls->xls_colmax) { return -2; }
+  if (frow < xls->dim_rowmin) { xls->dim_rowmin = frow; }
+  if (lrow > xls->dim_rowmax) { xls->dim_rowmax = lrow; }
+  if (fcol < xls->dim_colmin) { xls->dim_colmin = fcol; }
+  if (lcol > xls->dim_colmax) { xls->dim_colmax = lcol; }
+
+  xf = wsheet_xf(fmt);
+  for (i = 0; i <= lcol - fcol; i++)
+    xfs[i] = xf;
+
+  for (row = frow; row <= lrow; row++) {
+    int ret = wsheet_store_mulblank((struct bwctx *)xls, row, fcol, xfs, lcol - fcol + 1);
+    if (ret != 0)
+      return ret;
+  }
 
-  wsheet_append(xls, pkt->data, pkt->len);
-  pkt_free(pkt);
   return 0;
 }
 
-int xls_write_string(struct wsheetctx *xls, int row, int col, char *str)
+int xls_write_string(struct wsheetctx *xls, int row, int col, const char *str)
 {
   return xls_writef_string(xls, row, col, str, NULL);
 }
@@ -496,6 +1713,11 @@ int xls_write_number(struct wsheetctx *xls, int row, int col, double num)
   return xls_writef_number(xls, row, col, num, NULL);
 }
 
+int xls_write_int(struct wsheetctx *xls, int row, int col, int32_t num)
+{
+  return xls_writef_int(xls, row, col, num, NULL);
+}
+
 void wsheet_set_column(struct wsheetctx *ws, int fcol, int lcol, int width)
 {
   struct col_info *ci;
@@ -521,10 +1743,13 @@ void wsheet_set_column(struct wsheetctx *ws, int fcol, int lcol, int width)
 
 void wsheet_store_selection(struct wsheetctx *xls, int frow, int fcol, int lrow, int lcol)
 {
-  struct pkt *pkt;
+  struct bwctx *biff = (struct bwctx *)xls;
+  unsigned char *p;
   int tmp;
 
-  pkt = pkt_init(0, VARIABLE_PACKET);
+  p = bw_reserve(biff, 19);
+  if (p == NULL)
+    return;
 
   /* Swap rows and columns around */
   if (frow > lrow) {
@@ -540,39 +1765,38 @@ void wsheet_store_selection(struct wsheetctx *xls, int frow, int fcol, int lrow,
   }
 
   /* Write header */
-  pkt_add16_le(pkt, 0x001D);  /* Record identifier */
-  pkt_add16_le(pkt, 0x000F);  /* Number of bytes to follow */
-
-  pkt_add8(pkt, 3);  /* Pane position */
-  pkt_add16_le(pkt, frow);  /* Active row */
-  pkt_add16_le(pkt, fcol);  /* Active column */
-  pkt_add16_le(pkt, 0);     /* Active cell ref */
-  pkt_add16_le(pkt, 1);     /* Number of refs */
-  pkt_add16_le(pkt, frow);  /* First row in reference */
-  pkt_add16_le(pkt, lrow);  /* Last row in reference */
-  pkt_add8(pkt, fcol);      /* First col in reference */
-  pkt_add8(pkt, lcol);      /* Last col in reference */
-
-  wsheet_append(xls, pkt->data, pkt->len);
-  pkt_free(pkt);
+  p = xl_put16_le(p, 0x001D);  /* Record identifier */
+  p = xl_put16_le(p, 0x000F);  /* Number of bytes to follow */
+
+  p = xl_put8(p, 3);  /* Pane position */
+  p = xl_put16_le(p, frow);  /* Active row */
+  p = xl_put16_le(p, fcol);  /* Active column */
+  p = xl_put16_le(p, 0);     /* Active cell ref */
+  p = xl_put16_le(p, 1);     /* Number of refs */
+  p = xl_put16_le(p, frow);  /* First row in reference */
+  p = xl_put16_le(p, lrow);  /* Last row in reference */
+  p = xl_put8(p, fcol);      /* First col in reference */
+  p = xl_put8(p, lcol);      /* Last col in reference */
+
+  bw_commit(biff, 19);
 }
 
 /* Write BIFF record DEFCOLWIDTH if COLINFO records are in use. */
 void wsheet_store_defcol(struct wsheetctx *wsheet)
 {
-  struct pkt *pkt;
+  unsigned char buf[6];
+  struct pkt pkt;
 
-  pkt = pkt_init(6, FIXED_PACKET);
+  pkt_attach(&pkt, buf, sizeof(buf));
 
   /* Write header */
-  pkt_add16_le(pkt, 0x0055);  /* Record identifier */
-  pkt_add16_le(pkt, 0x0002);  /* Number of bytes to follow */
+  pkt_add16_le(&pkt, 0x0055);  /* Record identifier */
+  pkt_add16_le(&pkt, 0x0002);  /* Number of bytes to follow */
 
   /* Write data */
-  pkt_add16_le(pkt, 0x0008);  /* Default column width */
+  pkt_add16_le(&pkt, 0x0008);  /* Default column width */
 
-  bw_prepend((struct bwctx *)wsheet, pkt->data, pkt->len);
-  pkt_free(pkt);
+  bw_append(&wsheet->head, pkt.data, pkt.len);
 }
 
 /* Write BIFF record COLINFO to define column widths
@@ -581,28 +1805,28 @@ void wsheet_store_defcol(struct wsheetctx *wsheet)
  * length record */
 void wsheet_store_colinfo(struct wsheetctx *wsheet, struct col_info *ci)
 {
-  struct pkt *pkt;
+  unsigned char buf[15];
+  struct pkt pkt;
   float tmp;
 
-  pkt = pkt_init(0, VARIABLE_PACKET);
+  pkt_attach(&pkt, buf, sizeof(buf));
 
   tmp = (float)ci->col_width + 0.72;   /* Fudge.  Excel subtracts 0.72 !? */
   tmp *= 256;  /* Convert to units of 1/256 of a char */
 
   /* Write header */
-  pkt_add16_le(pkt, 0x007D);  /* Record identifier */
-  pkt_add16_le(pkt, 0x000B);  /* Number of bytes to follow */
+  pkt_add16_le(&pkt, 0x007D);  /* Record identifier */
+  pkt_add16_le(&pkt, 0x000B);  /* Number of bytes to follow */
 
   /* Write data */
-  pkt_add16_le(pkt, ci->first_col);  /* First formatted column */
-  pkt_add16_le(pkt, ci->last_col);   /* Last formatted column */
-  pkt_add16_le(pkt, (int)tmp);       /* Column width */
-  pkt_add16_le(pkt, ci->xf);         /* XF */
-  pkt_add16_le(pkt, ci->grbit);      /* Option flags */
-  pkt_add8(pkt, 0x00);               /* Reserved */
-
-  bw_prepend((struct bwctx *)wsheet, pkt->data, pkt->len);
-  pkt_free(pkt);
+  pkt_add16_le(&pkt, ci->first_col);  /* First formatted column */
+  pkt_add16_le(&pkt, ci->last_col);   /* Last formatted column */
+  pkt_add16_le(&pkt, (int)tmp);       /* Column width */
+  pkt_add16_le(&pkt, ci->xf);         /* XF */
+  pkt_add16_le(&pkt, ci->grbit);      /* Option flags */
+  pkt_add8(&pkt, 0x00);               /* Reserved */
+
+  bw_append(&wsheet->head, pkt.data, pkt.len);
 }
 
 /* write_url
@@ -612,11 +1836,22 @@ void wsheet_store_colinfo(struct wsheetctx *wsheet, struct col_info *ci)
  * alternative string is specified.  The label is written using the
  * write_string function.  Therefore the 255 character string limit applies.
  */
-int wsheet_write_url(struct wsheetctx *wsheet, int row, int col, char *url, char *string, struct xl_format *fmt)
+int wsheet_write_url(struct wsheetctx *wsheet, int row, int col, const char *url, const char *str, struct xl_format *fmt)
+{
+  size_t urllen = strlen(url);
+
+  if (str == NULL)
+    return wsheet_write_url_n(wsheet, row, col, url, urllen, url, urllen, fmt);
+  return wsheet_write_url_n(wsheet, row, col, url, urllen, str, strlen(str), fmt);
+}
+
+/* As wsheet_write_url() but with explicit lengths; neither url nor str
+ * need be NUL terminated.  str may be NULL to display the url itself. */
+int wsheet_write_url_n(struct wsheetctx *wsheet, int row, int col, const char *url, size_t urllen, const char *str, size_t len, struct xl_format *fmt)
 {
-  struct pkt *pkt;
+  struct bwctx *biff = (struct bwctx *)wsheet;
+  unsigned char *p;
   int length;
-  char *str;
   unsigned char unknown[40] =
   { 0xD0, 0xC9, 0xEA, 0x79, 0xF9, 0xBA, 0xCE, 0x11, 0x8C, 0x82,
     0x00, 0xAA, 0x00, 0x4B, 0xA9, 0x0B, 0x02, 0x00, 0x00, 0x00,
@@ -624,29 +1859,32 @@ int wsheet_write_url(struct wsheetctx *wsheet, int row, int col, char *url, char
     0xCE, 0x11, 0x8C, 0x82, 0x00, 0xAA, 0x00, 0x4B, 0xA9, 0x0B
   };
 
-  str = string;
-  if (str == NULL)
+  if (str == NULL) {
     str = url;
+    len = urllen;
+  }
+
+  xls_writef_string_n(wsheet, row, col, str, len, fmt);
 
-  xls_writef_string(wsheet, row, col, str, fmt);
+  length = 0x0034 + 2 * (1 + urllen);
 
-  length = 0x0034 + 2 * (1 + strlen(url));
-  pkt = pkt_init(0, VARIABLE_PACKET);
+  p = bw_reserve(biff, 56 + urllen);
+  if (p == NULL)
+    return -1;
 
   /* Write header */
-  pkt_add16_le(pkt, 0x01B8);  /* Record identifier */
-  pkt_add16_le(pkt, length);  /* Number of bytes to follow */
+  p = xl_put16_le(p, 0x01B8);  /* Record identifier */
+  p = xl_put16_le(p, length);  /* Number of bytes to follow */
 
-  pkt_add16_le(pkt, row);     /* Row number */
-  pkt_add16_le(pkt, row);     /* Row number */
-  pkt_add16_le(pkt, col);     /* Column number */
-  pkt_add16_le(pkt, col);     /* Column number */
-  pkt_addraw(pkt, unknown, sizeof(unknown));
-  pkt_add32_le(pkt, strlen(url));
+  p = xl_put16_le(p, row);     /* Row number */
+  p = xl_put16_le(p, row);     /* Row number */
+  p = xl_put16_le(p, col);     /* Column number */
+  p = xl_put16_le(p, col);     /* Column number */
+  p = xl_putraw(p, unknown, sizeof(unknown));
+  p = xl_put32_le(p, urllen);
 
-  pkt_addraw(pkt, (unsigned char *)url, strlen(url));
-  wsheet_append(wsheet, pkt->data, pkt->len);
-  pkt_free(pkt);
+  p = xl_putraw(p, url, urllen);
+  bw_commit(biff, 56 + urllen);
 
   return 0;
 }
@@ -655,7 +1893,8 @@ int wsheet_write_url(struct wsheetctx *wsheet, int row, int col, char *url, char
  * Writes the BIFF record ROW. */
 void wsheet_set_row(struct wsheetctx *wsheet, int row, int height, struct xl_format *fmt)
 {
-  struct pkt *pkt;
+  struct bwctx *biff = (struct bwctx *)wsheet;
+  unsigned char *p;
   int rowHeight;
   uint16_t xf; /* The cell format */
 
@@ -667,22 +1906,23 @@ void wsheet_set_row(struct wsheetctx *wsheet, int row, int height, struct xl_for
 
   xf = wsheet_xf(fmt);
 
-  pkt = pkt_init(0, VARIABLE_PACKET);
+  p = bw_reserve(biff, 20);
+  if (p == NULL)
+    return;
 
   /* Write header */
-  pkt_add16_le(pkt, 0x0208);  /* Record identifier */
-  pkt_add16_le(pkt, 0x0010);  /* Number of bytes to follow */
+  p = xl_put16_le(p, 0x0208);  /* Record identifier */
+  p = xl_put16_le(p, 0x0010);  /* Number of bytes to follow */
 
   /* Write payload */
-  pkt_add16_le(pkt, row);     /* Row number */
-  pkt_add16_le(pkt, 0x0000);  /* First defined column */
-  pkt_add16_le(pkt, 0x0000);  /* Last defined column */
-  pkt_add16_le(pkt, rowHeight); /* Row height */
-  pkt_add16_le(pkt, 0x0000);  /* Used by Excel to optimise loading */
-  pkt_add16_le(pkt, 0x0000);  /* Reserved */
-  pkt_add16_le(pkt, 0x01C0);  /* Option flags. */
-  pkt_add16_le(pkt, xf);      /* XF index */
-
-  wsheet_append(wsheet, pkt->data, pkt->len);
-  pkt_free(pkt);
+  p = xl_put16_le(p, row);     /* Row number */
+  p = xl_put16_le(p, 0x0000);  /* First defined column */
+  p = xl_put16_le(p, 0x0000);  /* Last defined column */
+  p = xl_put16_le(p, rowHeight); /* Row height */
+  p = xl_put16_le(p, 0x0000);  /* Used by Excel to optimise loading */
+  p = xl_put16_le(p, 0x0000);  /* Reserved */
+  p = xl_put16_le(p, 0x01C0);  /* Option flags. */
+  p = xl_put16_le(p, xf);      /* XF index */
+
+  bw_commit(biff, 20);
 }
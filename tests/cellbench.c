@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "excel.h"
+
+/* Times the single cell writers and, with glibc, counts the allocations
+ * each kind of write makes.  The cell and row paths should not allocate
+ * at all; occasional growth of the record buffer is the only exception.
+ *
+ *   cellbench [rows]
+ */
+
+#define COLS 100
+#define KINDS 7
+
+static const char *kinds[KINDS] = {
+  "string", "number", "integer", "blank", "formula", "url", "row"
+};
+
+#ifdef __GLIBC__
+/* Interpose the allocator so calls from the library are counted too */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static long allocs;
+
+void *malloc(size_t size)
+{
+  allocs++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+  allocs++;
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  allocs++;
+  return __libc_realloc(ptr, size);
+}
+#define ALLOCS() (allocs)
+#else
+#define ALLOCS() (-1L)
+#endif
+
+int main(int argc, char *argv[])
+{
+  struct wbookctx *wbook;
+  struct wsheetctx *sheet;
+  clock_t start, end;
+  long counted[KINDS], writes[KINDS];
+  long before;
+  int rows, row, col, k;
+
+  rows = argc > 1 ? atoi(argv[1]) : 10000;
+  if (rows <= 0)
+    rows = 10000;
+
+  wbook = wbook_new("cellbench.xls", 0);
+  sheet = wbook_addworksheet(wbook, "Cells");
+
+  for (k = 0; k < KINDS; k++) {
+    counted[k] = 0;
+    writes[k] = 0;
+  }
+
+  start = clock();
+  for (row = 0; row < rows; row++) {
+    for (col = 0; col < COLS; col++) {
+      k = col % (KINDS - 1);
+      before = ALLOCS();
+      switch (k) {
+      case 0: xls_write_string(sheet, row, col, "abc"); break;
+      case 1: xls_write_number(sheet, row, col, row * 1.5 + col); break;
+      case 2: xls_write_number(sheet, row, col, row); break;
+      case 3: xls_write_blank(sheet, row, col, NULL); break;
+      case 4: wsheet_writef_formula(sheet, row, col, "=SUM(A1,B1)+2*3", NULL); break;
+      default: wsheet_write_url(sheet, row, col, "http://example.com/", "link", NULL); break;
+      }
+      counted[k] += ALLOCS() - before;
+      writes[k]++;
+    }
+    before = ALLOCS();
+    wsheet_set_row(sheet, row, 12, NULL);
+    counted[KINDS - 1] += ALLOCS() - before;
+    writes[KINDS - 1]++;
+  }
+  end = clock();
+
+  printf("%d cells, %d rows: %.1f ns/cell\n", rows * COLS, rows,
+      (double)(end - start) * 1e9 / CLOCKS_PER_SEC / ((double)rows * COLS));
+  if (ALLOCS() >= 0) {
+    printf("allocations per write:\n");
+    for (k = 0; k < KINDS; k++)
+      printf("  %-8s %.4f\n", kinds[k], (double)counted[k] / writes[k]);
+  } else
+    printf("allocations per write: not counted on this libc\n");
+
+  wbook_close(wbook);
+  wbook_destroy(wbook);
+
+  return 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "excel.h"
+#include "xlcsv.h"
+#include "xlsread.h"
+
+/* Imports the same CSV data from a regular file, which is mapped, and
+ * from a pipe, which is read in chunks, and checks both sheets cell by
+ * cell.  The data has quoted fields with doubled quotes and embedded
+ * line breaks, empty fields and both LF and CRLF record ends, and is
+ * larger than the pipe buffer so fields straddle reads. */
+
+#define ROWS 1500
+#define FIRST_ROW 1
+#define FIRST_COL 2
+
+static char *
+make_csv(size_t *len)
+{
+  size_t cap = ROWS * 96 + 64, n = 0;
+  char *buf;
+  int i;
+
+  buf = malloc(cap);
+  for (i = 0; i < ROWS - 1; i++) {
+    n += sprintf(buf + n, "%d,\"q \"\"x\"\" %d\",\"line1\r\nline2 %d\",,3.5e1,"
+        "plain %d%s", i, i, i, i, i % 2 ? "\r\n" : "\n");
+  }
+  /* The last record has no line break and ends in an open quote */
+  n += sprintf(buf + n, "%d,\"q \"\"x\"\" %d\",\"line1\r\nline2 %d\",,3.5e1,"
+      "\"open", i, i, i);
+
+  *len = n;
+  return buf;
+}
+
+static int
+check_sheet(const char *label, struct wsheetctx *sheet)
+{
+  const unsigned char *data = sheet->base.data;
+  size_t len = sheet->base.datasize;
+  struct xr_cell cell;
+  char want[256];
+  int i, col = FIRST_COL;
+
+  for (i = 0; i < ROWS; i++) {
+    int row = FIRST_ROW + i;
+
+    if (xr_find(data, len, row, col - 1, &cell) != XR_NONE)
+      goto bad;
+    if (xr_find(data, len, row, col, &cell) != XR_NUMBER || cell.num != i)
+      goto bad;
+    sprintf(want, "q \"x\" %d", i);
+    if (xr_find(data, len, row, col + 1, &cell) != XR_STRING ||
+        strcmp(cell.str, want) != 0)
+      goto bad;
+    sprintf(want, "line1\r\nline2 %d", i);
+    if (xr_find(data, len, row, col + 2, &cell) != XR_STRING ||
+        strcmp(cell.str, want) != 0)
+      goto bad;
+    if (xr_find(data, len, row, col + 3, &cell) != XR_NONE)
+      goto bad;
+    if (xr_find(data, len, row, col + 4, &cell) != XR_NUMBER || cell.num != 35)
+      goto bad;
+    if (i < ROWS - 1)
+      sprintf(want, "plain %d", i);
+    else
+      strcpy(want, "open");
+    if (xr_find(data, len, row, col + 5, &cell) != XR_STRING ||
+        strcmp(cell.str, want) != 0)
+      goto bad;
+    continue;
+bad:
+    fprintf(stderr, "%s: record %d read back wrong\n", label, i);
+    return -1;
+  }
+
+  if (xr_find(data, len, FIRST_ROW + ROWS, col, &cell) != XR_NONE) {
+    fprintf(stderr, "%s: extra record\n", label);
+    return -1;
+  }
+
+  return 0;
+}
+
+#ifndef WIN32
+/* Feed csv to the sheet through a pipe from a child process */
+static int
+import_pipe(struct wsheetctx *sheet, const char *csv, size_t len,
+    const struct xl_csv_options *opts)
+{
+  int fds[2], status, ret;
+  pid_t pid;
+  size_t off;
+  ssize_t n;
+
+  if (pipe(fds) != 0)
+    return -1;
+
+  pid = fork();
+  if (pid < 0)
+    return -1;
+  if (pid == 0) {
+    close(fds[0]);
+    /* Odd sized writes so reads end in the middle of fields */
+    for (off = 0; off < len; off += n) {
+      n = write(fds[1], csv + off, len - off < 4093 ? len - off : 4093);
+      if (n <= 0)
+        _exit(1);
+    }
+    _exit(0);
+  }
+
+  close(fds[1]);
+  ret = xls_import_csv_fd(sheet, fds[0], opts);
+  close(fds[0]);
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0)
+    return -1;
+
+  return ret;
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+  struct wbookctx *wbook;
+  struct wsheetctx *mapped;
+  struct xl_csv_options opts;
+  FILE *fp;
+  char *csv;
+  size_t len;
+  int ret;
+
+  csv = make_csv(&len);
+  fp = fopen("csv1.csv", "wb");
+  if (fp == NULL || fwrite(csv, 1, len, fp) != len) {
+    perror("csv1.csv");
+    return 1;
+  }
+  fclose(fp);
+
+  memset(&opts, 0, sizeof(opts));
+  opts.first_row = FIRST_ROW;
+  opts.first_col = FIRST_COL;
+
+  wbook = wbook_new("csv1.xls", 1);
+
+  mapped = wbook_addworksheet(wbook, "file");
+  ret = xls_import_csv(mapped, "csv1.csv", &opts);
+  if (ret != 0) {
+    fprintf(stderr, "xls_import_csv returned %d\n", ret);
+    return 1;
+  }
+  if (check_sheet("file", mapped) != 0)
+    return 1;
+
+#ifndef WIN32
+  {
+    struct wsheetctx *piped = wbook_addworksheet(wbook, "pipe");
+
+    ret = import_pipe(piped, csv, len, &opts);
+    if (ret != 0) {
+      fprintf(stderr, "xls_import_csv_fd returned %d\n", ret);
+      return 1;
+    }
+    if (check_sheet("pipe", piped) != 0)
+      return 1;
+    if (piped->base.datasize != mapped->base.datasize ||
+        memcmp(piped->base.data, mapped->base.data, mapped->base.datasize) != 0) {
+      fprintf(stderr, "file and pipe imports differ\n");
+      return 1;
+    }
+  }
+#endif
+
+  /* Rows before the first one are out of range */
+  opts.first_row = -1;
+  ret = xls_import_csv(wbook_addworksheet(wbook, "negative"), "csv1.csv", &opts);
+  if (ret != -2) {
+    fprintf(stderr, "import at row -1 returned %d\n", ret);
+    return 1;
+  }
+
+  wbook_close(wbook);
+  wbook_destroy(wbook);
+  free(csv);
+  remove("csv1.csv");
+
+  return 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "excel.h"
+#include "lz.h"
+
+/* Round trips blocks of every awkward size and kind through the spill
+ * compressor, makes sure bad input is refused without writing out of
+ * bounds, and checks that a workbook spilled with XL_SPILL_LZ comes out
+ * the same as one spilled without it. */
+
+enum { FILL_ZERO, FILL_TEXT, FILL_RANDOM, FILL_RECORDS, FILL_KINDS };
+
+static unsigned int seed = 12345;
+
+static unsigned int
+rnd(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+static void
+fill(unsigned char *p, size_t n, int kind)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    switch (kind) {
+    case FILL_ZERO:
+      p[i] = 0;
+      break;
+    case FILL_TEXT:
+      p[i] = "the quick brown fox jumps over the lazy dog "[i % 44];
+      break;
+    case FILL_RANDOM:
+      p[i] = (unsigned char)rnd();
+      break;
+    default:
+      /* NUMBER records: the same header, a row count and a payload */
+      switch (i % 18) {
+      case 0: p[i] = 0x03; break;
+      case 1: p[i] = 0x02; break;
+      case 2: p[i] = 14; break;
+      case 4: p[i] = (unsigned char)(i / 18); break;
+      case 5: p[i] = (unsigned char)(i / 18 >> 8); break;
+      default: p[i] = i % 18 < 10 ? 0 : (unsigned char)rnd(); break;
+      }
+      break;
+    }
+  }
+}
+
+static int
+check_block(size_t n, int kind)
+{
+  unsigned char *src, *z, *out;
+  size_t zlen, cap = XL_LZ_BOUND(n);
+  int bad = 0;
+
+  /* Exact sizes so that overruns are caught */
+  src = malloc(n ? n : 1);
+  z = malloc(cap);
+  out = malloc(n ? n : 1);
+  fill(src, n, kind);
+
+  zlen = xl_lz_compress(src, n, z, cap);
+  if (zlen == 0 || zlen > cap) {
+    fprintf(stderr, "%lu bytes of kind %d: compressed to %lu\n",
+        (unsigned long)n, kind, (unsigned long)zlen);
+    bad++;
+    goto done;
+  }
+
+  if (xl_lz_decompress(z, zlen, out, n) != n || memcmp(out, src, n) != 0) {
+    fprintf(stderr, "%lu bytes of kind %d: no round trip\n",
+        (unsigned long)n, kind);
+    bad++;
+  }
+
+  /* One byte short of room, or of input, must not give the data back */
+  if (n > 0 && xl_lz_decompress(z, zlen, out, n - 1) != 0) {
+    fprintf(stderr, "%lu bytes of kind %d: overran a short buffer\n",
+        (unsigned long)n, kind);
+    bad++;
+  }
+  if (n > 0 && xl_lz_decompress(z, zlen - 1, out, n) == n) {
+    fprintf(stderr, "%lu bytes of kind %d: took truncated input\n",
+        (unsigned long)n, kind);
+    bad++;
+  }
+
+done:
+  free(src);
+  free(z);
+  free(out);
+  return bad;
+}
+
+static int
+check_codec(void)
+{
+  static const size_t sizes[] = {
+    0, 1, 4, 5, 12, 13, 17, 100, 255, 256, 4096, 65535, XL_LZ_MAXBLOCK
+  };
+  static unsigned char big[XL_LZ_MAXBLOCK + 1], z[XL_LZ_BOUND(XL_LZ_MAXBLOCK + 1)];
+  size_t i;
+  int kind, bad = 0;
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    for (kind = 0; kind < FILL_KINDS; kind++)
+      bad += check_block(sizes[i], kind);
+
+  /* Out of range arguments are refused */
+  if (xl_lz_compress(big, sizeof(big), z, sizeof(z)) != 0) {
+    fprintf(stderr, "took a block over XL_LZ_MAXBLOCK\n");
+    bad++;
+  }
+  if (xl_lz_compress(big, 100, z, XL_LZ_BOUND(100) - 1) != 0) {
+    fprintf(stderr, "took a short output buffer\n");
+    bad++;
+  }
+
+  /* A match reaching back before the start of the output */
+  z[0] = 0x10;
+  z[1] = 'a';
+  z[2] = 2;
+  z[3] = 0;
+  if (xl_lz_decompress(z, 4, big, sizeof(big)) != 0) {
+    fprintf(stderr, "took an offset before the data\n");
+    bad++;
+  }
+
+  return bad;
+}
+
+/* Write the same workbook with a spill backend and return its bytes */
+static unsigned char *
+spill_book(const char *name, int backend, long *size)
+{
+  struct wbookctx *wbook;
+  struct wsheetctx *sheet;
+  unsigned char *data;
+  char buf[32];
+  FILE *fp;
+  int s, i;
+
+  seed = 777;
+  wbook = wbook_new(name, 0);
+  wbook_set_spill(wbook, backend);
+  for (s = 0; s < 2; s++) {
+    sheet = wbook_addworksheet(wbook, NULL);
+    for (i = 0; i < 120000; i++) {
+      int row = i / 20, col = i % 20;
+
+      if (col == 0) {
+        sprintf(buf, "item %d", row % 300);
+        xls_write_string(sheet, row, col, buf);
+      } else if (col < 10) {
+        xls_write_number(sheet, row, col, row * 0.5 + col);
+      } else {
+        /* Random doubles leave blocks that do not compress */
+        xls_write_number(sheet, row, col, rnd() / 7.3);
+      }
+    }
+  }
+  wbook_close(wbook);
+  wbook_destroy(wbook);
+
+  fp = fopen(name, "rb");
+  if (fp == NULL)
+    return NULL;
+  fseek(fp, 0, SEEK_END);
+  *size = ftell(fp);
+  rewind(fp);
+  data = malloc(*size);
+  if (fread(data, 1, *size, fp) != (size_t)*size) {
+    free(data);
+    data = NULL;
+  }
+  fclose(fp);
+
+  return data;
+}
+
+static int
+check_spill(void)
+{
+  static const int backends[] = {
+    XL_SPILL_STDIO | XL_SPILL_LZ, XL_SPILL_MMAP | XL_SPILL_LZ
+  };
+  unsigned char *ref, *data;
+  long refsize, size;
+  size_t i;
+  int bad = 0;
+
+  ref = spill_book("lz1.xls", XL_SPILL_STDIO, &refsize);
+  if (ref == NULL)
+    return 1;
+
+  for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+    data = spill_book("lz1.xls", backends[i], &size);
+    if (data == NULL || size != refsize || memcmp(data, ref, size) != 0) {
+      fprintf(stderr, "spill backend 0x%x: workbook differs\n", backends[i]);
+      bad++;
+    }
+    free(data);
+  }
+
+  free(ref);
+  return bad;
+}
+
+int main(int argc, char *argv[])
+{
+  int bad;
+
+  bad = check_codec();
+  bad += check_spill();
+
+  return bad == 0 ? 0 : 1;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "excel.h"
+#include "lz.h"
+
+/* Measures the spill compressor on worksheet data of three kinds: plain
+ * numbers, a typical mix of strings, ints and numbers, and random
+ * numbers that barely compress.  The data is the record stream of an
+ * in-memory sheet, cut into XL_LZ_MAXBLOCK blocks as the spill file
+ * does.
+ *
+ *   lzbench [reps]
+ */
+
+#define CELLS 300000
+#define COLS 20
+
+enum { DATA_NUMBERS, DATA_MIXED, DATA_RANDOM };
+
+static void
+fill(struct wsheetctx *sheet, int kind)
+{
+  unsigned int seed = 7;
+  char buf[32];
+  int i, row, col;
+
+  for (i = 0; i < CELLS; i++) {
+    row = i / COLS;
+    col = i % COLS;
+    switch (kind) {
+    case DATA_NUMBERS:
+      xls_write_number(sheet, row, col, i * 0.25);
+      break;
+    case DATA_MIXED:
+      if (col % 4 == 0) {
+        sprintf(buf, "CUST-%05d", row % 5000);
+        xls_write_string(sheet, row, col, buf);
+      } else if (col % 4 == 1) {
+        xls_write_int(sheet, row, col, row);
+      } else {
+        xls_write_number(sheet, row, col, (row * 31 + col) * 0.01);
+      }
+      break;
+    default:
+      seed = seed * 1103515245 + 12345;
+      xls_write_number(sheet, row, col, seed / 7.3);
+      break;
+    }
+  }
+}
+
+static void
+run(const char *label, int kind, int reps)
+{
+  static unsigned char zbuf[XL_LZ_BOUND(XL_LZ_MAXBLOCK)];
+  static unsigned char out[XL_LZ_MAXBLOCK];
+  struct wbookctx *wbook;
+  struct wsheetctx *sheet;
+  const unsigned char *data;
+  size_t len, off, n, z, stored = 0;
+  clock_t start;
+  double tc = 0, td = 0;
+  int rep;
+
+  wbook = wbook_new("lzbench.xls", 1);
+  sheet = wbook_addworksheet(wbook, NULL);
+  fill(sheet, kind);
+  data = sheet->base.data;
+  len = sheet->base.datasize;
+
+  for (rep = 0; rep < reps; rep++) {
+    stored = 0;
+    for (off = 0; off < len; off += n) {
+      n = len - off < XL_LZ_MAXBLOCK ? len - off : XL_LZ_MAXBLOCK;
+
+      start = clock();
+      z = xl_lz_compress(data + off, n, zbuf, sizeof(zbuf));
+      tc += clock() - start;
+      /* The spill file keeps a block raw when it does not shrink */
+      stored += z != 0 && z < n ? z : n;
+      if (z == 0 || z >= n)
+        continue;
+
+      start = clock();
+      if (xl_lz_decompress(zbuf, z, out, sizeof(out)) != n ||
+          memcmp(out, data + off, n) != 0) {
+        fprintf(stderr, "%s: block at %lu does not round trip\n", label,
+            (unsigned long)off);
+        exit(1);
+      }
+      td += clock() - start;
+    }
+  }
+
+  tc /= CLOCKS_PER_SEC;
+  td /= CLOCKS_PER_SEC;
+  printf("%-7s %8lu KB -> %8lu KB (saved %4.1f%%)  compress %7.1f MB/s"
+      "  decompress %7.1f MB/s\n", label, (unsigned long)(len / 1024),
+      (unsigned long)(stored / 1024), 100.0 * (len - stored) / len,
+      tc > 0 ? len * (double)reps / tc / 1e6 : 0.0,
+      td > 0 ? len * (double)reps / td / 1e6 : 0.0);
+
+  wbook_destroy(wbook);
+}
+
+int main(int argc, char *argv[])
+{
+  int reps;
+
+  reps = argc > 1 ? atoi(argv[1]) : 10;
+  if (reps <= 0)
+    reps = 10;
+
+  run("numbers", DATA_NUMBERS, reps);
+  run("mixed", DATA_MIXED, reps);
+  run("random", DATA_RANDOM, reps);
+
+  return 0;
+}
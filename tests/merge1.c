@@ -39,8 +39,7 @@ int main(int argc, char *argv[])
   fmt_set_merge(fmt);
 
   xls_writef_string(sheet, 2, 1, "Merged Cells", fmt);
-  xls_write_blank(sheet, 2, 2, fmt);
-  xls_write_blank(sheet, 2, 3, fmt);
+  xls_write_blank_range(sheet, 2, 2, 2, 3, fmt);
 
   wbook_close(wbook);
   wbook_destroy(wbook);
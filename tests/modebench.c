@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "excel.h"
+
+/* Compares store_in_memory worksheets with tmpfile() backed ones for
+ * small, medium and large sheets.  Sizes are of the cell data; NUMBER
+ * records are 18 bytes each.
+ *
+ *   modebench [reps-scale]
+ */
+
+#define RECLEN 18
+#define COLS 200
+
+static double
+run(size_t bytes, int in_memory, int reps)
+{
+  struct wbookctx *wbook;
+  struct wsheetctx *sheet;
+  clock_t start;
+  int cells, rep, i;
+
+  cells = bytes / RECLEN;
+  start = clock();
+  for (rep = 0; rep < reps; rep++) {
+    wbook = wbook_new("modebench.xls", in_memory);
+    sheet = wbook_addworksheet(wbook, NULL);
+    /* Non-integral values so every cell is a NUMBER and not an RK */
+    for (i = 0; i < cells; i++)
+      xls_write_number(sheet, i / COLS, i % COLS, i + 0.1);
+    wbook_close(wbook);
+    wbook_destroy(wbook);
+  }
+
+  return (double)(clock() - start) * 1e3 / CLOCKS_PER_SEC / reps;
+}
+
+int main(int argc, char *argv[])
+{
+  static const size_t sizes[] = { 10 * 1024, 1024 * 1024, 7 * 1024 * 1024 };
+  size_t i;
+  int scale, reps;
+  double mem, file;
+
+  scale = argc > 1 ? atoi(argv[1]) : 1;
+  if (scale <= 0)
+    scale = 1;
+
+  printf("%10s %12s %12s\n", "bytes", "memory ms", "tmpfile ms");
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    /* About 20 MB of cells per mode, and at least one workbook */
+    reps = scale * (20 * 1024 * 1024 / sizes[i]);
+    if (reps < 1)
+      reps = 1;
+    mem = run(sizes[i], 1, reps);
+    file = run(sizes[i], 0, reps);
+    printf("%10lu %12.3f %12.3f\n", (unsigned long)sizes[i], mem, file);
+  }
+
+  return 0;
+}
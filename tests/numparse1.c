@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "numparse.h"
+
+/* Checks how xl_parse_text() classifies text and the value it returns,
+ * and that xl_parse_double() agrees bit for bit with strtod() over a
+ * spread of generated numbers.  Every input is copied to a buffer of
+ * exactly its length so reads past the end show up under a checker. */
+
+struct textcase {
+  const char *text;
+  int type;
+  double value;
+};
+
+static const struct textcase cases[] = {
+  /* Numbers */
+  { "0", XL_TEXT_NUMBER, 0 },
+  { "-0", XL_TEXT_NUMBER, -0.0 },
+  { "+1", XL_TEXT_NUMBER, 1 },
+  { "1.", XL_TEXT_NUMBER, 1 },
+  { ".5", XL_TEXT_NUMBER, 0.5 },
+  { "-.5", XL_TEXT_NUMBER, -0.5 },
+  { "1e5", XL_TEXT_NUMBER, 1e5 },
+  { "1E-5", XL_TEXT_NUMBER, 1e-5 },
+  { "000123", XL_TEXT_NUMBER, 123 },
+  { "3.14159", XL_TEXT_NUMBER, 3.14159 },
+  /* 19 digits still fit the mantissa, 20 do not */
+  { "1234567890123456789", XL_TEXT_NUMBER, 1234567890123456789.0 },
+  { "12345678901234567890", XL_TEXT_NUMBER, 12345678901234567890.0 },
+  { "0.12345678901234567890", XL_TEXT_NUMBER, 0.12345678901234567890 },
+  /* Leading zeros do not count as digits */
+  { "0000000000000000000000001.5", XL_TEXT_NUMBER, 1.5 },
+  { "0.0000000000000000000000015", XL_TEXT_NUMBER, 1.5e-24 },
+  { "1e-400", XL_TEXT_NUMBER, 0 },
+  /* Too long for the stack copy handed to strtod() */
+  { "1234567890123456789012345678901234567890123456789012345678901234567890",
+    XL_TEXT_NUMBER,
+    1234567890123456789012345678901234567890123456789012345678901234567890.0 },
+  { "3.14159265358979323846264338327950288419716939937510582097494459230781640628",
+    XL_TEXT_NUMBER,
+    3.14159265358979323846264338327950288419716939937510582097494459230781640628 },
+  { "1e400", XL_TEXT_STRING, 0 },
+  { "", XL_TEXT_STRING, 0 },
+  { "-", XL_TEXT_STRING, 0 },
+  { ".", XL_TEXT_STRING, 0 },
+  { "1e", XL_TEXT_STRING, 0 },
+  { "1e+", XL_TEXT_STRING, 0 },
+  { "1.2.3", XL_TEXT_STRING, 0 },
+  { " 1", XL_TEXT_STRING, 0 },
+  { "1 ", XL_TEXT_STRING, 0 },
+  { "0x10", XL_TEXT_STRING, 0 },
+  { "1,5", XL_TEXT_STRING, 0 },
+  { "--1", XL_TEXT_STRING, 0 },
+  { "inf", XL_TEXT_STRING, 0 },
+  { "nan", XL_TEXT_STRING, 0 },
+  { "abc", XL_TEXT_STRING, 0 },
+
+  /* Percentages */
+  { "50%", XL_TEXT_PERCENT, 0.5 },
+  { "-12.5%", XL_TEXT_PERCENT, -0.125 },
+  { "1e2%", XL_TEXT_PERCENT, 1 },
+  { "%", XL_TEXT_STRING, 0 },
+  { "5%%", XL_TEXT_STRING, 0 },
+  { "5 %", XL_TEXT_STRING, 0 },
+
+  /* Dates, with Excel's phantom 1900-02-29 */
+  { "2024-01-15", XL_TEXT_DATE, 45306 },
+  { "2024-02-29", XL_TEXT_DATE, 45351 },
+  { "1999-12-31", XL_TEXT_DATE, 36525 },
+  { "1900-01-01", XL_TEXT_DATE, 1 },
+  { "1900-02-28", XL_TEXT_DATE, 59 },
+  { "1900-03-01", XL_TEXT_DATE, 61 },
+  { "2023-02-29", XL_TEXT_STRING, 0 },
+  { "1900-02-29", XL_TEXT_STRING, 0 },
+  { "2024-13-01", XL_TEXT_STRING, 0 },
+  { "2024-04-31", XL_TEXT_STRING, 0 },
+  { "2024-00-10", XL_TEXT_STRING, 0 },
+  { "1899-12-31", XL_TEXT_STRING, 0 },
+  { "2024-1-15", XL_TEXT_STRING, 0 },
+  { "2024-01-15X", XL_TEXT_STRING, 0 },
+
+  /* Dates with times */
+  { "2024-01-15T12:00", XL_TEXT_DATETIME, 45306.5 },
+  { "2024-01-15 06:00:00Z", XL_TEXT_DATETIME, 45306.25 },
+  { "2024-01-15T18:00:00.000", XL_TEXT_DATETIME, 45306.75 },
+  { "2024-01-15T25:00", XL_TEXT_STRING, 0 },
+  { "2024-01-15T", XL_TEXT_STRING, 0 },
+
+  /* Times of day */
+  { "9:30", XL_TEXT_TIME, 9.5 / 24 },
+  { "09:30", XL_TEXT_TIME, 9.5 / 24 },
+  { "23:59:59", XL_TEXT_TIME, 86399 / 86400.0 },
+  { "12:00:00.5", XL_TEXT_TIME, 43200.5 / 86400 },
+  { "00:00Z", XL_TEXT_TIME, 0 },
+  { "24:00", XL_TEXT_STRING, 0 },
+  { "12:60", XL_TEXT_STRING, 0 },
+  { "12:30:60", XL_TEXT_STRING, 0 },
+  { "1:2", XL_TEXT_STRING, 0 },
+  { "12:30:", XL_TEXT_STRING, 0 },
+  { "12:30:00.", XL_TEXT_STRING, 0 },
+  { "123:45", XL_TEXT_STRING, 0 }
+};
+
+static unsigned long long state = 88172645463325252ULL;
+
+static unsigned long long
+rnd(void)
+{
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+/* Parse text from an exactly sized copy */
+static int
+parse_text(const char *text, size_t len, double *out)
+{
+  char *copy = malloc(len + 1);
+  int type;
+
+  memcpy(copy, text, len);
+  type = xl_parse_text(len ? copy : copy + 1, len, out);
+  free(copy);
+
+  return type;
+}
+
+static int
+check_cases(void)
+{
+  size_t i;
+  double v;
+  int type, bad = 0;
+
+  for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    v = 0;
+    type = parse_text(cases[i].text, strlen(cases[i].text), &v);
+    if (type != cases[i].type ||
+        (type != XL_TEXT_STRING && fabs(v - cases[i].value) > 1e-12 * fabs(cases[i].value)) ||
+        (type != XL_TEXT_STRING && signbit(v) != signbit(cases[i].value))) {
+      fprintf(stderr, "\"%s\": got type %d value %.17g, want %d %.17g\n",
+          cases[i].text, type, v, cases[i].type, cases[i].value);
+      bad++;
+    }
+  }
+
+  /* Only the first len bytes count */
+  if (parse_text("12345", 3, &v) != XL_TEXT_NUMBER || v != 123) {
+    fprintf(stderr, "length not honoured\n");
+    bad++;
+  }
+
+  return bad;
+}
+
+static int
+check_numbers(void)
+{
+  char buf[80];
+  double a, b;
+  long n;
+  int len, bad = 0;
+
+  for (n = 0; n < 200000; n++) {
+    unsigned long long bits;
+
+    switch (n % 4) {
+    case 0:
+      bits = rnd();
+      memcpy(&a, &bits, sizeof(a));
+      if (!isfinite(a))
+        continue;
+      len = sprintf(buf, "%.17g", a);
+      break;
+    case 1:
+      len = sprintf(buf, "%.*g", (int)(rnd() % 19) + 1,
+          (double)(rnd() % 1000000000) / (rnd() % 100000 + 1) * (rnd() & 1 ? 1e-20 : 1e15));
+      break;
+    case 2:
+      len = sprintf(buf, "%llu.%llue%d", rnd() % 10000000000ULL,
+          rnd() % 1000000000ULL, (int)(rnd() % 140) - 70);
+      break;
+    default:
+      len = sprintf(buf, "-0.%019llu", rnd() % 10000000000000000000ULL);
+      break;
+    }
+
+    if (parse_text(buf, len, &a) != XL_TEXT_NUMBER) {
+      fprintf(stderr, "\"%s\" not taken as a number\n", buf);
+      bad++;
+      continue;
+    }
+    b = strtod(buf, NULL);
+    if (memcmp(&a, &b, sizeof(a)) != 0) {
+      fprintf(stderr, "\"%s\": got %.17g, strtod says %.17g\n", buf, a, b);
+      bad++;
+    }
+    if (bad > 10)
+      break;
+  }
+
+  return bad;
+}
+
+int main(int argc, char *argv[])
+{
+  int bad;
+
+  bad = check_cases();
+  bad += check_numbers();
+
+  return bad == 0 ? 0 : 1;
+}
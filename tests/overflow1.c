@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "excel.h"
+
+/* Writes a 40 KB hyperlink and a sheet big enough to need more than one
+ * big block depot sector, then walks the OLE container that came out.
+ * Exits non-zero if the file is not what was written. */
+
+#define URLLEN 40000
+#define ROWS 3500
+#define COLS 100
+
+static unsigned int
+get32(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+/* Next sector in a big block chain, read from the depot */
+static unsigned int
+next_block(const unsigned char *file, unsigned int blk)
+{
+  unsigned int depot;
+
+  depot = get32(file + 0x4C + 4 * (blk / 128));
+  return get32(file + 512 * (depot + 1) + 4 * (blk % 128));
+}
+
+static int
+check(const unsigned char *file, long size)
+{
+  const unsigned char magic[8] =
+    { 0xD0, 0xCF, 0x11, 0xE0, 0xA1, 0xB1, 0x1A, 0xE1 };
+  const unsigned char *dir, *book;
+  unsigned int nbbd, blk, booksize, nblocks, i;
+  unsigned char *stream, *p;
+  int found;
+
+  if (size < 1024 || size % 512 != 0 || memcmp(file, magic, 8) != 0) {
+    fprintf(stderr, "not an OLE file\n");
+    return -1;
+  }
+
+  nbbd = get32(file + 0x2C);
+  if (nbbd < 2 || nbbd > 109) {
+    fprintf(stderr, "expected a multi-sector depot, got %u\n", nbbd);
+    return -1;
+  }
+
+  /* Every big block must be described by the depot */
+  nblocks = size / 512 - 1;
+  if (nblocks > nbbd * 128) {
+    fprintf(stderr, "%u blocks but depot covers %u\n", nblocks, nbbd * 128);
+    return -1;
+  }
+
+  /* The workbook stream is the entry after the root */
+  dir = file + 512 * (get32(file + 0x30) + 1);
+  book = dir + 128;
+  blk = get32(book + 0x74);
+  booksize = get32(book + 0x78);
+
+  stream = malloc(booksize + 512);
+  if (stream == NULL)
+    return -1;
+  for (p = stream, i = 0; i < booksize; i += 512, p += 512) {
+    if (blk >= nblocks) {
+      fprintf(stderr, "broken chain at offset %u\n", i);
+      free(stream);
+      return -1;
+    }
+    memcpy(p, file + 512 * (blk + 1), 512);
+    blk = next_block(file, blk);
+  }
+  if (blk != 0xFFFFFFFE) {
+    fprintf(stderr, "chain does not end after %u bytes\n", booksize);
+    free(stream);
+    return -1;
+  }
+
+  /* The URL must be there in full, after its length */
+  found = 0;
+  for (p = stream; p + 4 + URLLEN <= stream + booksize; p++) {
+    if (get32(p) == URLLEN && memcmp(p + 4, "http://", 7) == 0 &&
+        p[4 + URLLEN - 1] == 'a') {
+      found = 1;
+      break;
+    }
+  }
+  free(stream);
+  if (!found) {
+    fprintf(stderr, "hyperlink missing\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  struct wbookctx *wbook;
+  struct wsheetctx *sheet;
+  unsigned char *file;
+  char *url;
+  FILE *fp;
+  long size;
+  int row, col, ret;
+
+  url = malloc(URLLEN + 1);
+  memset(url, 'a', URLLEN);
+  memcpy(url, "http://", 7);
+  url[URLLEN] = '\0';
+
+  wbook = wbook_new("overflow1.xls", 0);
+  sheet = wbook_addworksheet(wbook, "Big");
+
+  if (wsheet_write_url(sheet, 0, 0, url, "link", NULL) != 0) {
+    fprintf(stderr, "wsheet_write_url failed\n");
+    return 1;
+  }
+  for (row = 1; row < ROWS; row++)
+    for (col = 0; col < COLS; col++)
+      xls_write_number(sheet, row, col, row + col * 0.5);
+
+  wbook_close(wbook);
+  wbook_destroy(wbook);
+  free(url);
+
+  if ((fp = fopen("overflow1.xls", "rb")) == NULL) {
+    perror("overflow1.xls");
+    return 1;
+  }
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  rewind(fp);
+  file = malloc(size);
+  if (fread(file, 1, size, fp) != (size_t)size) {
+    fclose(fp);
+    return 1;
+  }
+  fclose(fp);
+
+  ret = check(file, size);
+  free(file);
+
+  return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "excel.h"
+
+/* Writes a workbook with several sheets, a row of each at a time, so that
+ * their spilled data ends up interleaved in the workbook's one spill
+ * file.  Every variant, closed on one thread or on several, must produce
+ * the same bytes as the workbook built entirely in memory. */
+
+#define SHEETS 4
+#define ROWS 3000
+#define COLS 12
+
+struct variant {
+  const char *label;
+  int in_memory;
+  int backend;
+  size_t budget;  /* 0 for none */
+};
+
+static const struct variant variants[] = {
+  { "tmpfile", 0, XL_SPILL_STDIO, 0 },
+  { "stdio", 0, XL_SPILL_STDIO, 64 * 1024 },
+  { "mmap", 0, XL_SPILL_MMAP, 64 * 1024 },
+  { "stdio+lz", 0, XL_SPILL_STDIO | XL_SPILL_LZ, 64 * 1024 },
+  { "mmap+lz", 0, XL_SPILL_MMAP | XL_SPILL_LZ, 64 * 1024 },
+  { "memory+budget", 1, XL_SPILL_STDIO, 128 * 1024 },
+  { "memory", 1, XL_SPILL_STDIO, 0 }
+};
+
+static const int threads[] = { 1, 4 };
+
+static void
+write_row(struct wsheetctx *sheet, struct xl_format *bold, int s, int row)
+{
+  struct xl_row *cur;
+  char buf[32];
+  int col;
+
+  if (row % 2 == 0) {
+    for (col = 0; col < COLS; col++) {
+      if (col == 0) {
+        sprintf(buf, "sheet %d row %d", s, row);
+        xls_write_string(sheet, row, col, buf);
+      } else if (col % 3 == 0) {
+        xls_write_number(sheet, row, col, row * 0.1 + col);
+      } else if (col % 3 == 1) {
+        xls_writef_number(sheet, row, col, row + col + s, bold);
+      } else {
+        xls_write_blank(sheet, row, col, bold);
+      }
+    }
+    return;
+  }
+
+  /* Odd rows go through the row cursor */
+  cur = xls_row_begin(sheet, row);
+  sprintf(buf, "cursor %d", row);
+  xls_row_add_string(cur, buf, NULL);
+  for (col = 1; col < COLS; col++)
+    xls_row_add_number(cur, col % 2 ? row + col : row / 3.0 + col, NULL);
+  xls_row_end(cur);
+}
+
+/* Build the workbook and return its bytes */
+static unsigned char *
+build(const char *name, const struct variant *v, int threads, long *size)
+{
+  struct wbookctx *wbook;
+  struct wsheetctx *sheets[SHEETS];
+  struct xl_format *bold;
+  unsigned char *data;
+  char sname[16];
+  FILE *fp;
+  int s, row;
+
+  wbook = wbook_new(name, v->in_memory);
+  wbook_set_spill(wbook, v->backend);
+  if (v->budget)
+    wbook_set_memory_budget(wbook, v->budget);
+  wbook_set_threads(wbook, threads);
+
+  bold = wbook_addformat(wbook);
+  fmt_set_bold(bold, 1);
+
+  for (s = 0; s < SHEETS; s++) {
+    sprintf(sname, "Sheet %d", s + 1);
+    sheets[s] = wbook_addworksheet(wbook, sname);
+    wsheet_set_column(sheets[s], 0, 0, 20 + s);
+  }
+
+  for (row = 0; row < ROWS; row++) {
+    for (s = 0; s < SHEETS; s++) {
+      /* Sheets fill at different rates, so they spill at different times */
+      if (row % (s + 1) == 0)
+        write_row(sheets[s], bold, s, row);
+    }
+  }
+
+  wbook_close(wbook);
+  wbook_destroy(wbook);
+
+  fp = fopen(name, "rb");
+  if (fp == NULL)
+    return NULL;
+  fseek(fp, 0, SEEK_END);
+  *size = ftell(fp);
+  rewind(fp);
+  data = malloc(*size);
+  if (fread(data, 1, *size, fp) != (size_t)*size) {
+    free(data);
+    data = NULL;
+  }
+  fclose(fp);
+
+  return data;
+}
+
+int main(int argc, char *argv[])
+{
+  static const struct variant ref_variant = { "memory", 1, XL_SPILL_STDIO, 0 };
+  unsigned char *ref, *data;
+  long refsize, size;
+  size_t i, t;
+  int bad = 0;
+
+  ref = build("spill1.xls", &ref_variant, 1, &refsize);
+  if (ref == NULL) {
+    fprintf(stderr, "could not build the reference workbook\n");
+    return 1;
+  }
+
+  for (t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+    for (i = 0; i < sizeof(variants) / sizeof(variants[0]); i++) {
+      data = build("spill1.xls", &variants[i], threads[t], &size);
+      if (data == NULL || size != refsize || memcmp(data, ref, size) != 0) {
+        fprintf(stderr, "%s, %d threads: workbook differs from the "
+            "in-memory one\n", variants[i].label, threads[t]);
+        bad++;
+      }
+      free(data);
+    }
+  }
+
+  free(ref);
+  return bad == 0 ? 0 : 1;
+}
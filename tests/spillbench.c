@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "excel.h"
+
+/* Compares the tmpfile() spill backend with the mmap one.  Writing and
+ * closing are timed apart since they stress different halves of the
+ * backend.  Where mmap is not available both rows measure stdio.
+ *
+ *   spillbench [sheets [cells-per-sheet [reps]]]
+ */
+
+#define COLS 200
+
+static void
+run(const char *label, int backend, int sheets, int cells, int reps)
+{
+  struct wbookctx *wbook;
+  struct wsheetctx *sheet;
+  clock_t start;
+  double write = 0, close = 0;
+  int rep, s, i;
+
+  for (rep = 0; rep < reps; rep++) {
+    wbook = wbook_new("spillbench.xls", 0);
+    wbook_set_spill(wbook, backend);
+
+    start = clock();
+    for (s = 0; s < sheets; s++) {
+      sheet = wbook_addworksheet(wbook, NULL);
+      for (i = 0; i < cells; i++)
+        xls_write_number(sheet, i / COLS, i % COLS, i + 0.1 + s);
+    }
+    write += clock() - start;
+
+    start = clock();
+    wbook_close(wbook);
+    close += clock() - start;
+    wbook_destroy(wbook);
+  }
+
+  printf("%-6s %d x %d cells: write %8.3f ms  close %8.3f ms\n", label,
+      sheets, cells, write * 1e3 / CLOCKS_PER_SEC / reps,
+      close * 1e3 / CLOCKS_PER_SEC / reps);
+}
+
+int main(int argc, char *argv[])
+{
+  int sheets, cells, reps;
+
+  sheets = argc > 1 ? atoi(argv[1]) : 4;
+  cells = argc > 2 ? atoi(argv[2]) : 200000;
+  reps = argc > 3 ? atoi(argv[3]) : 5;
+  if (sheets <= 0 || cells <= 0 || reps <= 0) {
+    fprintf(stderr, "usage: spillbench [sheets [cells-per-sheet [reps]]]\n");
+    return 1;
+  }
+
+  run("stdio", XL_SPILL_STDIO, sheets, cells, reps);
+  run("mmap", XL_SPILL_MMAP, sheets, cells, reps);
+
+  return 0;
+}
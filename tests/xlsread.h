@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2010 Devin Smith <devin@devinsmith.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __XLSREAD_H__
+#define __XLSREAD_H__
+
+/* Just enough of a BIFF reader for the tests to look cells up again in
+ * a worksheet's record stream. */
+
+#include <string.h>
+
+#define XR_NONE   0
+#define XR_NUMBER 1
+#define XR_STRING 2
+#define XR_BLANK  3
+#define XR_BOOL   4
+
+struct xr_cell {
+  int type;
+  int xf;
+  double num;
+  char str[256];
+};
+
+static unsigned int
+xr_get16(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static double
+xr_double(const unsigned char *p)
+{
+  union { double d; unsigned char b[8]; } u;
+  int i, le = 1;
+
+  if (*(const unsigned char *)&le)
+    memcpy(u.b, p, 8);
+  else
+    for (i = 0; i < 8; i++)
+      u.b[i] = p[7 - i];
+  return u.d;
+}
+
+static double
+xr_rk(const unsigned char *p)
+{
+  unsigned int rk;
+  unsigned char b[8];
+  double d;
+
+  rk = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+  if (rk & 2) {
+    d = (double)((int)rk >> 2);
+  } else {
+    memset(b, 0, 4);
+    b[4] = rk & 0xFC;
+    b[5] = rk >> 8;
+    b[6] = rk >> 16;
+    b[7] = rk >> 24;
+    d = xr_double(b);
+  }
+
+  return rk & 1 ? d / 100 : d;
+}
+
+/* Find the cell at row/col among the records in data[0..len).  Returns
+ * its type, XR_NONE if no record covers it. */
+static int
+xr_find(const unsigned char *data, size_t len, int row, int col, struct xr_cell *cell)
+{
+  const unsigned char *p = data, *end = data + len;
+  unsigned int id, n, first, last, i;
+
+  memset(cell, 0, sizeof(*cell));
+
+  while (end - p >= 4) {
+    id = xr_get16(p);
+    n = xr_get16(p + 2);
+    p += 4;
+    if ((size_t)(end - p) < n || n < 6 || (int)xr_get16(p) != row) {
+      p += n;
+      continue;
+    }
+
+    first = xr_get16(p + 2);
+    switch (id) {
+    case 0x0203: /* NUMBER */
+    case 0x027E: /* RK */
+    case 0x0204: /* LABEL */
+    case 0x0201: /* BLANK */
+    case 0x0205: /* BOOLERR */
+      if ((int)first != col)
+        break;
+      cell->xf = xr_get16(p + 4);
+      if (id == 0x0203) {
+        cell->type = XR_NUMBER;
+        cell->num = xr_double(p + 6);
+      } else if (id == 0x027E) {
+        cell->type = XR_NUMBER;
+        cell->num = xr_rk(p + 6);
+      } else if (id == 0x0204) {
+        cell->type = XR_STRING;
+        memcpy(cell->str, p + 8, xr_get16(p + 6));
+      } else if (id == 0x0201) {
+        cell->type = XR_BLANK;
+      } else {
+        cell->type = XR_BOOL;
+        cell->num = p[6];
+      }
+      return cell->type;
+    case 0x00BD: /* MULRK */
+    case 0x00BE: /* MULBLANK */
+      last = xr_get16(p + n - 2);
+      if ((int)first > col || (int)last < col)
+        break;
+      i = col - first;
+      if (id == 0x00BD) {
+        cell->type = XR_NUMBER;
+        cell->xf = xr_get16(p + 4 + 6 * i);
+        cell->num = xr_rk(p + 6 + 6 * i);
+      } else {
+        cell->type = XR_BLANK;
+        cell->xf = xr_get16(p + 4 + 2 * i);
+      }
+      return cell->type;
+    }
+    p += n;
+  }
+
+  return XR_NONE;
+}
+
+#endif /* __XLSREAD_H__ */